@@ -2,6 +2,8 @@
 // Called from the main loop 20 times per second
 // This where the bake logic is controlled
 
+#include "Temperature.h"
+
 extern char debugBuffer[];
 
 #define MILLIS_TO_SECONDS    ((long) 1000)
@@ -10,14 +12,15 @@ extern char debugBuffer[];
 boolean Bake() {
   static int bakePhase = BAKING_PHASE_INIT;
   static int outputType[4];
-  static int bakeTemperature;
+  static qdeg_t bakeTemperature;
   static uint16_t bakeDuration;
   static int elementDutyCounter[4];
   static int bakeDutyCycle, bakeIntegral, counter, coolingDuration;
   static boolean isHeating;
   static long lastOverTempTime = 0;
+  static boolean stopped = false;        // Everything is off, waiting for the last message to be read
   
-  double currentTemperature;
+  qdeg_t currentTemperature;
   int i;
   boolean isOneSecondInterval = false;
 
@@ -28,11 +31,12 @@ boolean Bake() {
   }
   
   // Read the temperature
-  currentTemperature = getCurrentTemperature();
-  if (THERMOCOUPLE_FAULT(currentTemperature)) {
+  const TC_Sample_t& sample = temps.getSample();
+  currentTemperature = sample.temperature;
+  if (THERMOCOUPLE_FAULT(sample.fault) && (bakePhase != BAKING_PHASE_ABORT)) {
     lcdPrintLine_P(0, PSTR("Thermocouple err"));
     Serial.print(F("Thermocouple Error: "));
-    switch ((int) currentTemperature) {
+    switch (sample.fault) {
       case FAULT_OPEN:
         lcdPrintLine_P(1, PSTR("Fault open"));
         Serial.println(F("Fault open"));
@@ -43,36 +47,46 @@ boolean Bake() {
         break;
       case FAULT_SHORT_VCC:
         lcdPrintLine_P(1, PSTR("Short to VCC"));
+        Serial.println(F("Short to VCC"));
+        break;
+      case FAULT_OVERTEMP:
+        lcdPrintLine_P(1, PSTR("Over temperature"));
+        Serial.println(F("Over temperature"));
+        break;
+      default:
+        lcdPrintLine_P(1, PSTR("Unknown fault"));
+        Serial.println(F("Unknown fault"));
         break;
     }
     
     // Abort the bake
     Serial.println(F("Bake aborted because of thermocouple error!"));
     bakePhase = BAKING_PHASE_ABORT;
-    delay(3000);
+    holdMessage(3000);
   }
   
   // Abort the bake if a button is pressed
-  if (buttons.GetKeypress() != BUTTON_BOT_LONG_HOLD) {
+  if ((buttons.GetKeypress() == BUTTON_BOT_LONG_HOLD) && (bakePhase != BAKING_PHASE_ABORT)) {
     bakePhase = BAKING_PHASE_ABORT;
-    lcdPrintLine_P(0, PSTR("Aborting bake"));
-    lcdPrintLine_P(1, PSTR("Button pressed"));
+    showMessage(FM("Aborting bake   "), FM("Button pressed  "), 2000);
     Serial.println(F("Button pressed.  Aborting bake ..."));
-    delay(2000);
   }
   
   switch (bakePhase) {
     case PHASE_INIT: // User has requested to start a bake
       // Start the bake, regardless of the starting temperature
+      // Bakes are long, so smooth the temperature readings heavily
+      temps.setFilterMode(FILTER_IIR);
+
       // Get the types for the outputs (elements, fan or unused)
       for (i=0; i<4; i++)
         outputType[i] = getSetting(SETTING_D4_TYPE + i);
       // Get the bake temperature
-      bakeTemperature = getSetting(SETTING_BAKE_TEMPERATURE);
+      bakeTemperature = qdegFromDegrees(getSetting(SETTING_BAKE_TEMPERATURE));
       // Get the bake duration
       bakeDuration = getBakeSeconds(getSetting(SETTING_BAKE_DURATION));
       Serial.print(F("Baking temperature = "));
-      Serial.println(bakeTemperature);
+      Serial.println(qdegToDegrees(bakeTemperature));
       Serial.print(F("Baking duration = "));
       Serial.println(bakeDuration);
       
@@ -81,13 +95,11 @@ boolean Bake() {
         if (isHeatingElement(outputType[i]))
           break;
       if (i == 4) {
-        lcdPrintLine_P(0, PSTR("Please configure"));
-        lcdPrintLine_P(1, PSTR(" outputs first! "));
+        showMessage(FM("Please configure"), FM(" outputs first! "), 3000);
         Serial.println(F("Outputs must be configured before baking"));
         
         // Abort the baking
         bakePhase = BAKING_PHASE_ABORT;
-        delay(3000);
         break;
       }
 
@@ -103,7 +115,7 @@ boolean Bake() {
       lcdPrintLine_P(1, PSTR(""));
 
       // Start with a duty cycle proportional to the desired temperature
-      bakeDutyCycle = map(bakeTemperature, 0, 250, 0, 100);
+      bakeDutyCycle = map(bakeTemperature, 0, QDEG(250), 0, 100);
       
       isHeating = true;
       bakeIntegral = 0;
@@ -124,7 +136,7 @@ boolean Bake() {
       }
         
       // Is the oven close to the desired temperature?
-      if (bakeTemperature - currentTemperature < 15.0) {
+      if (qdegSub(bakeTemperature, currentTemperature) < QDEG(15)) {
         bakePhase = BAKING_PHASE_BAKE;
         lcdPrintLine(0, bakingPhaseDescription[bakePhase]);
         // Reduce the duty cycle for the last 10 degrees
@@ -175,7 +187,7 @@ boolean Bake() {
         isHeating = true;
 
         // Increase the bake integral if not close to temperature
-        if (bakeTemperature - currentTemperature > 1.0)
+        if (qdegSub(bakeTemperature, currentTemperature) > QDEG(1))
           bakeIntegral++;
           
         // Has the oven been under-temperature for a while?
@@ -227,21 +239,30 @@ boolean Bake() {
         // Wait in this phase until the oven has cooled
         if (coolingDuration > 0)
           coolingDuration--;      
-        if (currentTemperature < 50.0 && coolingDuration == 0)
+        if (currentTemperature < QDEG(50) && coolingDuration == 0)
           bakePhase = BAKING_PHASE_ABORT;
       }
       break;
 
      case BAKING_PHASE_ABORT:
-      Serial.println(F("Bake is done!"));
-      isHeating = false;
-      // Turn all elements and fans off
-      for (i = 4; i < 8; i++)
-        digitalWrite(i, LOW);
-      // Close the oven door now, over 3 seconds
-      setServoPosition(getSetting(SETTING_SERVO_CLOSED_DEGREES), 3000);
+      if (!stopped) {
+        stopped = true;
+        Serial.println(F("Bake is done!"));
+        isHeating = false;
+        // Turn all elements and fans off
+        for (i = 4; i < 8; i++)
+          digitalWrite(i, LOW);
+        // Close the oven door now, over 3 seconds
+        setServoPosition(getSetting(SETTING_SERVO_CLOSED_DEGREES), 3000);
+      }
+      // Wait for any message to be read
+      if (messageShowing())
+        break;
       // Start next time with initialization
+      stopped = false;
       bakePhase = BAKING_PHASE_INIT;
+      // Back to the default filtering
+      temps.setFilterMode(FILTER_BOXCAR);
       // Return to the main menu
       return false;
   }
@@ -282,12 +303,13 @@ boolean Bake() {
 
 
 // Display the current temperature to the LCD screen and print it to the serial port so it can be plotted
-void DisplayBakeTime(uint16_t duration, double temperature, int duty, int integral) {
+void DisplayBakeTime(uint16_t duration, qdeg_t temperature, int duty, int integral) {
   // Display the temperature on the LCD screen
   // Write the time and temperature to the serial port, for graphing or analysis on a PC
   sprintf(debugBuffer, "%u, %i, %i, ", duration, duty, integral);
   Serial.print(debugBuffer);
-  Serial.println(temperature);
+  printQdeg(temperature);
+  Serial.println();
 
   displayDuration(10, duration);
 }
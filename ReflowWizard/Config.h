@@ -1,6 +1,8 @@
 #ifndef __CONFIG_H_
 #define __CONFIG_H_
 
+#include "Temperature.h"
+
 // Note temperatures are *2, so 0 = 0C, 1 = 2C, 100 = 200C, 255 = 510C (Maximum possible temp, allows a wide temp range, stored in a byte)
 
 #define TEMPERATURE_OFFSET                    150  // To allow temperature to be saved in 8-bits (0-255)
@@ -28,6 +30,9 @@ enum Element_Type_t
 extern const PROGMEM char listRelayType[];
 
 
+// Watts are stored /20, so 1 = 20W, 255 = 5100W
+#define POWER_UNIT_W                          20
+
 // Global Configuration
 enum SG_Entries_t
 {
@@ -49,7 +54,14 @@ enum SG_Entries_t
   SG_SERVO_ARMED_DEG,                   // Servo point just prior to opening door. (Degrees, 0-180) (Armed position)
   SG_SERVO_OPEN_DEG,                    // Servo point, door open Fully.           (Degrees, 0-180) (MAX Open position)
   SG_SERVO_OPEN_TIME,                   // Time to open door                       (10ths of a second)
-  
+
+  // Settings added since are appended here, so the ones above keep their place in EEPROM.
+  SG_D4_WATTS,                          // Power drawn by the load on Relay D4, when on. (Watts, 0 = Not counted against the circuit)
+  SG_D5_WATTS,                          // Power drawn by the load on Relay D5, when on. (Watts, 0 = Not counted against the circuit)
+  SG_D6_WATTS,                          // Power drawn by the load on Relay D6, when on. (Watts, 0 = Not counted against the circuit)
+  SG_D7_WATTS,                          // Power drawn by the load on Relay D7, when on. (Watts, 0 = Not counted against the circuit)
+  SG_CIRCUIT_WATTS,                     // Maximum Power the relays may draw at once.    (Watts, 0 = No limit)
+
   SG_CHECK_VALUE,                       // Check if Global Settings are correct - Always Last Element
 };
 
@@ -66,6 +78,7 @@ enum Mode_Type_t
   REFLOW,                                         // Reflow, Ready to USE.
   BAKE_LEARN,                                     // Bake, and Learning Needed
   BAKE,                                           // Bake, Ready to USE.
+  PROGRAM,                                        // Segment Program, see Program.h
 };
 
 // Reflow Configuration
@@ -109,8 +122,23 @@ enum SR_Entries_t {
   SR_COOL_DOOROPEN,                     // Door Open Distance (0 = Closed, 100 = Maximum Open)
                                         // COOL temperature is defined globally.
 
+  // Settings added since are appended here, so the ones above keep their place in EEPROM.
+  SR_LIQUIDUS_TEMP,                     // Liquidus Temperature of the Solder (Leaded = 183C, SAC305 = 217C)
+  SR_LIQUIDUS_MAXTIME,                  // Maximum Time above Liquidus (seconds) (J-STD-20 = 150)
+  SR_COOL_RATE,                         // Cooling Rate (0.1 Degrees per second, 0 = As fast as possible)
+
   SR_CHECK_VALUE,                       // Check if Reflow Settings are correct - Always Last Element
 };
+
+// Setting of a reflow phase, 0 = Presoak, 1 = Soak, 2 = Reflow.
+// eg, SR_PHASE(1, MAXTEMP) = SR_SOAK_MAXTEMP
+#define SR_PHASE(P, ENTRY) ((SR_Entries_t)(SR_PRESOAK_##ENTRY + ((P) * (SR_SOAK_MAXTEMP - SR_PRESOAK_MAXTEMP))))
+
+// Profile trajectory of the Current Mode.  Each reflow phase (0 - 2, as SR_PHASE)
+// ramps linearly from start to its MAXTEMP, over the middle of its MINTIME - MAXTIME window.
+uint32_t profileDuration(uint8_t phase);                            // ms
+qdeg_t   profileSetpoint(uint8_t phase, qdeg_t start, uint32_t ms); // ms into the phase
+int16_t  profileSlope(uint8_t phase, qdeg_t start, uint32_t ms);    // 0.01 Degree per second
             
 // Bake Configuration
 enum SB_Entries_t {
@@ -137,15 +165,30 @@ enum SB_Entries_t {
   
 };
 
+// Program Configuration
+enum SP_Entries_t {
+  SP_TYPE,                              // PROGRAM
+  
+  SP_NAME0,                             // First Byte of Name of Entry
+  SP_NAME1,                             // Next  Byte of Name of Entry
+  SP_NAME2,                             // Next  Byte of Name of Entry
+  SP_NAME3,                             // Next  Byte of Name of Entry
+  SP_NAME4,                             // Next  Byte of Name of Entry
+  SP_NAME_END,                          // Last  Byte of Name of Entry
+
+  SP_CODE,                              // First Byte of the Program's Segments, to SP_CHECK_VALUE - 1
+
+  SP_CHECK_VALUE = SR_CHECK_VALUE,      // Check if Program is correct - Always Last Element.
+};
+
 // Mode (Reflow or Bake) Reflow is the biggest set of settings, so size accordingly.
 typedef struct Mode_Settings_t {
   char& operator[](int i) { return byte[i]; }
   char byte[SR_CHECK_VALUE+1];
 } Mode_Settings_t;
 
-// Total Modes is (1024 Bytes - sizeof(Global Settings)) / sizeof(Mode Settings)
-// Global Settings ~= 14 Bytes
-// Mode Settings ~= 32 Bytes
-// Therefore Total Modes ~= (1024 - 14) / 32 ~= 31 Maximum Reflow/Baking Modes.  Which is A LOT.
+// EEPROM holds the Global Settings (21 Bytes, in the first 31), the layout version,
+// then 16 Modes of Mode Settings (35 Bytes each), then a learnt oven model per Mode,
+// the last run summaries, and the relay wear log at the top.  See Config.ino.
 
 #endif
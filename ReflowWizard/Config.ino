@@ -4,6 +4,8 @@
 #include "Config.h"
 #include <avr/eeprom.h>
 #include "Relays.h"
+#include "Model.h"
+#include "Metrics.h"
 
 #define EEPROM_START (0)
 #define GLOBAL_CONFIG_START (EEPROM_START)
@@ -12,11 +14,54 @@
 #define MODE_CONFIG_SIZE    (sizeof(Mode_Settings_t))
 #define MAX_MODES           (16)
 
+static_assert(GLOBAL_CONFIG_SIZE <= MODE_CONFIG_START, "Global Settings overlap the Mode Settings in EEPROM");
+
+// Learnt oven model of each Mode, after the Mode Settings.
+#define MODEL_CONFIG_START  (MODE_CONFIG_START + (MAX_MODES * MODE_CONFIG_SIZE))
+#define MODEL_CONFIG_SIZE   (sizeof(Oven_Model_t))
+
+// Relay wear log, at the top of EEPROM.
+// Each save goes to the next slot, so the writes are spread over them all.
+#define EEPROM_SIZE         (1024)
+#define RELAY_LOG_SLOTS     (6)
+#define RELAY_LOG_SIZE      (sizeof(Relay_Log_t))
+#define RELAY_LOG_START     (EEPROM_SIZE - (RELAY_LOG_SLOTS * RELAY_LOG_SIZE))
+#define RELAY_LOG_PERIOD_MS (10UL * 60UL * 1000UL) // Save at most every 10 minutes.
+                                                   // Each slot is written at most once an hour, 100,000 writes = 11 years.
+
+typedef struct Relay_Log_t {
+  uint16_t         sequence;                       // Highest is the newest
+  Relay_Counters_t counters;
+  uint8_t          check;                          // See CheckConfig, Always Last Element
+} Relay_Log_t;
+
+// Summaries of the last runs, after the Mode Models.
+// Each run goes in the slot after the newest, over the oldest.
+#define RUN_LOG_START       (MODEL_CONFIG_START + (MAX_MODES * MODEL_CONFIG_SIZE))
+#define RUN_LOG_SIZE        (sizeof(Run_Summary_t))
+
+static_assert((RUN_LOG_START + (METRICS_RUNS * RUN_LOG_SIZE)) <= RELAY_LOG_START,
+              "Run Summaries overlap the Relay Log in EEPROM");
+
+// Layout of the Modes, Models and Run Summaries, in the byte before the Modes.
+// Bump it when a change moves or reorders them, so records saved in the old
+// layout are invalidated, rather than misread.
+#define LAYOUT_VERSION_ADDR (MODE_CONFIG_START - 1)
+#define LAYOUT_VERSION      (2)   // 1 = SR_LIQUIDUS_* appended, 2 = SR_COOL_RATE appended
+
+static_assert(GLOBAL_CONFIG_SIZE <= LAYOUT_VERSION_ADDR, "Global Settings overlap the Layout Version in EEPROM");
+
 Global_Settings_t GlobalSettings;
 uint8_t           CurrentMode;
+Mode_Settings_t   ModeSettings;     // Settings of the Current Mode
+
+static uint8_t    RelayLogSlot;     // Slot last saved
+static uint16_t   RelayLogSequence; // Sequence last saved
+static uint32_t   RelayLogTotal;    // Sum of the counters last saved, to tell if they have changed
+static uint32_t   RelayLogTime;     // millis() of the last save
 
 // Menu List to match Relay Setting Enum.  
-const PROGMEM char listRelayType[] = "Unused|Fan:Conv|Fan:Cool|E:Bottom|E:Boost|E:Top";
+const PROGMEM char listRelayType[] = "Unused|Fan:Cool|Fan:Conv|E:Bottom|E:Boost|E:Top";
 
 const PROGMEM Global_Settings_t DefaultGlobalSettings = {
   ControLeo2_Relays::RELAY_UNUSED, // SG_D4_TYPE - Default to Unused because there are no safe assumptions about what they could be connected to.
@@ -37,10 +82,58 @@ const PROGMEM Global_Settings_t DefaultGlobalSettings = {
   90,           // SG_SERVO_ARMED_DEG   (90 Degree)
   135,          // SG_SERVO_OPEN_DEG    (135 Degree)
   15,           // SG_SERVO_OPEN_TIME   (1.5 Seconds)
-  
+
+  0,            // SG_D4_WATTS      (Not counted)
+  0,            // SG_D5_WATTS      (Not counted)
+  0,            // SG_D6_WATTS      (Not counted)
+  0,            // SG_D7_WATTS      (Not counted)
+  0,            // SG_CIRCUIT_WATTS (No limit)
+
   0xFF,         // Check if Global Settings are correct - Always Last Element  
 };
 
+// Used when a Mode has no good settings in EEPROM.
+// J-STD-20 leaded profile, with the original ControLeo starting duty cycles.
+const PROGMEM Mode_Settings_t DefaultReflowSettings = {
+  REFLOW_LEARN,                     // SR_TYPE
+  'J','-','S','T','D','\0',         // SR_NAME0 - SR_NAME_END
+
+  (150/2),      // SR_PRESOAK_MAXTEMP (150 degrees C)
+  60,           // SR_PRESOAK_MINTIME
+  110,          // SR_PRESOAK_MAXTIME
+  100,          // SR_PRESOAK_CONVFAN_DUTY_CYCLE
+  80,           // SR_PRESOAK_BOTTOM_DUTY_CYCLE
+  30,           // SR_PRESOAK_BOOST_DUTY_CYCLE
+  50,           // SR_PRESOAK_TOP_DUTY_CYCLE
+
+  (200/2),      // SR_SOAK_MAXTEMP (200 degrees C)
+  80,           // SR_SOAK_MINTIME
+  (char)140,    // SR_SOAK_MAXTIME
+  100,          // SR_SOAK_CONVFAN_DUTY_CYCLE
+  70,           // SR_SOAK_BOTTOM_DUTY_CYCLE
+  35,           // SR_SOAK_BOOST_DUTY_CYCLE
+  40,           // SR_SOAK_TOP_DUTY_CYCLE
+
+  (240/2),      // SR_REFLOW_MAXTEMP (240 degrees C)
+  60,           // SR_REFLOW_MINTIME
+  100,          // SR_REFLOW_MAXTIME
+  100,          // SR_REFLOW_CONVFAN_DUTY_CYCLE
+  80,           // SR_REFLOW_BOTTOM_DUTY_CYCLE
+  50,           // SR_REFLOW_BOOST_DUTY_CYCLE
+  50,           // SR_REFLOW_TOP_DUTY_CYCLE
+
+  40,           // SR_WAIT_MINTIME
+
+  100,          // SR_COOL_FANSPEED
+  100,          // SR_COOL_DOOROPEN
+
+  (183/2),      // SR_LIQUIDUS_TEMP (183 degrees C)
+  (char)150,    // SR_LIQUIDUS_MAXTIME
+  30,           // SR_COOL_RATE (3 degrees C per second)
+
+  (char)0xFF,   // Check if Reflow Settings are correct - Always Last Element
+};
+
 
 
 bool CheckConfig(uint16_t start, uint8_t size, uint8_t &check_value) {
@@ -63,6 +156,23 @@ bool CheckConfig(uint16_t start, uint8_t size, uint8_t &check_value) {
   return (check_value == eeprom_read_byte((const uint8_t *)start));
 }
 
+// Invalidate every Mode, Model and Run Summary, if they were saved in another layout.
+// Only their check bytes are written, so the Modes go back to their defaults.
+static void CheckLayout(void) {
+  uint8_t slot;
+
+  if (eeprom_read_byte((uint8_t *)LAYOUT_VERSION_ADDR) == LAYOUT_VERSION) return;
+
+  for (slot = 0; slot < MAX_MODES; slot++) {
+    eeprom_update_byte((uint8_t *)(MODE_CONFIG_START + ((slot + 1) * MODE_CONFIG_SIZE) - 1), 0xFF);
+    eeprom_update_byte((uint8_t *)(MODEL_CONFIG_START + ((slot + 1) * MODEL_CONFIG_SIZE) - 1), 0xFF);
+  }
+  for (slot = 0; slot < METRICS_RUNS; slot++) {
+    eeprom_update_byte((uint8_t *)(RUN_LOG_START + ((slot + 1) * RUN_LOG_SIZE) - 1), 0xFF);
+  }
+  eeprom_update_byte((uint8_t *)LAYOUT_VERSION_ADDR, LAYOUT_VERSION);
+}
+
 void ReadGlobalConfig(void) {
   uint8_t check_value;
 
@@ -79,8 +189,133 @@ void ReadGlobalConfig(void) {
     memcpy_P( &GlobalSettings,
               &DefaultGlobalSettings,
               GLOBAL_CONFIG_SIZE);
+
+    // Settings saved before the relay power settings were added end with their
+    // check byte where SG_D4_WATTS now is.  Keep them, with the new ones at their defaults.
+    if (CheckConfig(GLOBAL_CONFIG_START, SG_D4_WATTS + 1, check_value)) {
+      eeprom_read_block (&GlobalSettings,
+                         (void *)GLOBAL_CONFIG_START,
+                         SG_D4_WATTS);
+    }
   }
-  
+
+  relays.ReadSettings();
+  CheckLayout();
+}
+
+// Read a Mode's settings from EEPROM, into ModeSettings, and make it the Current Mode.
+// Returns false, and the default reflow settings, if the Mode has no good settings.
+bool ReadModeConfig(uint8_t mode) {
+  uint8_t  check_value;
+  uint16_t start = MODE_CONFIG_START + (mode * MODE_CONFIG_SIZE);
+
+  CurrentMode = mode;
+
+  if ((mode < MAX_MODES) && (CheckConfig(start, MODE_CONFIG_SIZE, check_value))) {
+    eeprom_read_block (&ModeSettings,
+                       (void *)start,
+                       MODE_CONFIG_SIZE);
+    return true;
+  }
+
+  memcpy_P( &ModeSettings,
+            &DefaultReflowSettings,
+            MODE_CONFIG_SIZE);
+  return false;
+}
+
+// Read the learnt oven model of a Mode.
+// Returns false if the Mode has not learnt one.
+bool ReadModeModel(uint8_t mode, Oven_Model_t& model) {
+  uint8_t  check_value;
+  uint16_t start = MODEL_CONFIG_START + (mode * MODEL_CONFIG_SIZE);
+
+  if ((mode < MAX_MODES) && (CheckConfig(start, MODEL_CONFIG_SIZE, check_value))) {
+    eeprom_read_block (&model,
+                       (void *)start,
+                       MODEL_CONFIG_SIZE);
+    return true;
+  }
+  return false;
+}
+
+void WriteModeModel(uint8_t mode, Oven_Model_t& model) {
+  uint16_t start = MODEL_CONFIG_START + (mode * MODEL_CONFIG_SIZE);
+
+  if (mode >= MAX_MODES) return;
+
+  // Check byte last, so a reset part way leaves the model invalid, not wrong.
+  eeprom_update_block(&model, (void *)start, MODEL_CONFIG_SIZE - 1);
+  CheckConfig(start, MODEL_CONFIG_SIZE, model.check);
+  eeprom_update_byte((uint8_t *)(start + MODEL_CONFIG_SIZE - 1), model.check);
+}
+
+uint16_t readModeSetting(SR_Entries_t entry) {
+  uint16_t value = (uint8_t)ModeSettings[entry];
+
+  // Check temp entries, and return actual value.
+  if ((entry == SR_PRESOAK_MAXTEMP) ||
+      (entry == SR_SOAK_MAXTEMP)    ||
+      (entry == SR_REFLOW_MAXTEMP)  ||
+      (entry == SR_LIQUIDUS_TEMP)) {
+    value *= 2;
+  }
+
+  return value;
+}
+
+// Length of a reflow phase's trajectory (ms).
+uint32_t profileDuration(uint8_t phase) {
+  return ((readModeSetting(SR_PHASE(phase, MINTIME)) + readModeSetting(SR_PHASE(phase, MAXTIME))) * 1000UL) / 2;
+}
+
+// Target temperature of a reflow phase, ms after it started from start.
+qdeg_t profileSetpoint(uint8_t phase, qdeg_t start, uint32_t ms) {
+  qdeg_t   end      = qdegFromDegrees(readModeSetting(SR_PHASE(phase, MAXTEMP)));
+  uint32_t duration = profileDuration(phase);
+
+  if ((duration == 0) || (ms >= duration)) return end;
+
+  return qdegSaturate(start + ((((int32_t)end) - start) * (int32_t)ms) / (int32_t)duration);
+}
+
+// Rate of rise (0.01 Degree per second) of a reflow phase's trajectory, ms after it started from start.
+int16_t profileSlope(uint8_t phase, qdeg_t start, uint32_t ms) {
+  qdeg_t   end      = qdegFromDegrees(readModeSetting(SR_PHASE(phase, MAXTEMP)));
+  uint32_t duration = profileDuration(phase);
+
+  if ((duration == 0) || (ms >= duration)) return 0;
+
+  return ((((int32_t)end) - start) * 25000L) / (int32_t)duration;
+}
+
+void writeModeSetting(SR_Entries_t entry, uint16_t value) {
+  // Check temp entries, and store corrected temp value (div 2).
+  if ((entry == SR_PRESOAK_MAXTEMP) ||
+      (entry == SR_SOAK_MAXTEMP)    ||
+      (entry == SR_REFLOW_MAXTEMP)  ||
+      (entry == SR_LIQUIDUS_TEMP)) {
+    value /= 2;
+  }
+
+  if (value != (uint8_t)ModeSettings[entry]) {
+    ModeSettings[entry] = (char)value;
+    ModeSettings[SR_CHECK_VALUE] = (char)0xFF; // Mark Mode Settings as DIRTY.
+  }
+}
+
+// Save the Current Mode's settings to EEPROM, if they have changed.
+void WriteModeConfig(void) {
+  uint8_t  check_value;
+  uint16_t start = MODE_CONFIG_START + (CurrentMode * MODE_CONFIG_SIZE);
+
+  if ((CurrentMode >= MAX_MODES) || ((uint8_t)ModeSettings[SR_CHECK_VALUE] != 0xFF)) return;
+
+  // Check byte last, so a reset part way leaves the Mode invalid, not wrong.
+  eeprom_update_block(&ModeSettings, (void *)start, MODE_CONFIG_SIZE - 1);
+  CheckConfig(start, MODE_CONFIG_SIZE, check_value);
+  ModeSettings[SR_CHECK_VALUE] = (char)check_value;
+  eeprom_update_byte((uint8_t *)(start + MODE_CONFIG_SIZE - 1), check_value);
 }
 
 uint16_t readGlobalSetting(SG_Entries_t entry) {
@@ -91,7 +326,9 @@ uint16_t readGlobalSetting(SG_Entries_t entry) {
       (entry == SG_MAX_TEMPERATURE)  ||
       (entry == SG_OVER_TEMPERATURE)) {
     value *= 2;
-  } 
+  } else if ((entry >= SG_D4_WATTS) && (entry <= SG_CIRCUIT_WATTS)) {
+    value *= POWER_UNIT_W;
+  }
   
   return value;
 }
@@ -102,14 +339,171 @@ void writeGlobalSetting(SG_Entries_t entry, uint16_t value) {
       (entry == SG_MAX_TEMPERATURE)  ||
       (entry == SG_OVER_TEMPERATURE)) {
     value /= 2;
+  } else if ((entry >= SG_D4_WATTS) && (entry <= SG_CIRCUIT_WATTS)) {
+    value = min(value / POWER_UNIT_W, 255);
   }
 
   if (value != GlobalSettings[entry]) {
     GlobalSettings[entry] = (uint8_t)value;
     GlobalSettings[SG_CHECK_VALUE] = 0xFF; // Mark Global Settings as DIRTY.
+
+    // Relays keep their own compiled copy of their settings.
+    if ((entry <= SG_D7_MAXPWR) || ((entry >= SG_D4_WATTS) && (entry <= SG_CIRCUIT_WATTS))) {
+      relays.ReadSettings();
+    }
+  }
+}
+
+
+// Sum of all the relay counters.  Only changes when a relay is used.
+static uint32_t RelayLogSum(const Relay_Counters_t& counters) {
+  uint32_t total = 0;
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    total += counters.switches[i] + counters.on_steps[i];
+  }
+  return total;
+}
+
+// Find the newest good relay log slot, and restore the relay counters from it.
+void ReadRelayLog(void) {
+  Relay_Log_t log;
+  uint16_t    start;
+  uint8_t     check_value;
+  bool        found = false;
+
+  RelayLogSlot     = RELAY_LOG_SLOTS - 1; // So a blank log starts at slot 0.
+  RelayLogSequence = 0;
+
+  for (uint8_t slot = 0; slot < RELAY_LOG_SLOTS; slot++) {
+    start = RELAY_LOG_START + (slot * RELAY_LOG_SIZE);
+    if (CheckConfig(start, RELAY_LOG_SIZE, check_value)) {
+      eeprom_read_block(&log, (void *)start, RELAY_LOG_SIZE);
+      // Newer, allowing for the sequence wrapping.
+      if ((!found) || ((int16_t)(log.sequence - RelayLogSequence) > 0)) {
+        RelayLogSlot     = slot;
+        RelayLogSequence = log.sequence;
+        relays.SetCounters(log.counters);
+        found = true;
+      }
+    }
   }
+
+  relays.GetCounters(log.counters);
+  RelayLogTotal = RelayLogSum(log.counters);
+  RelayLogTime  = millis();
 }
 
+// Call from the main loop.
+// Saves the relay counters to the next log slot, if they have changed,
+// but no more often than RELAY_LOG_PERIOD_MS.
+void ServiceRelayLog(void) {
+  Relay_Log_t log;
+  uint16_t    start;
+  uint32_t    total;
+
+  if ((millis() - RelayLogTime) < RELAY_LOG_PERIOD_MS) return;
+  RelayLogTime = millis();
+
+  relays.GetCounters(log.counters);
+  total = RelayLogSum(log.counters);
+  if (total == RelayLogTotal) return;
+
+  RelayLogSlot = (RelayLogSlot + 1) % RELAY_LOG_SLOTS;
+  RelayLogSequence++;
+  
+  log.sequence = RelayLogSequence;
+  log.check    = 0xFF;  // Until the block is written, so a part written slot fails its check.
+  start = RELAY_LOG_START + (RelayLogSlot * RELAY_LOG_SIZE);
+  eeprom_update_block(&log, (void *)start, RELAY_LOG_SIZE);
+
+  CheckConfig(start, RELAY_LOG_SIZE, log.check);
+  eeprom_update_byte((uint8_t *)(start + RELAY_LOG_SIZE - 1), log.check);
+
+  RelayLogTotal = total;
+}
+
+// Print the relay counters on the serial port.
+void PrintRelayLog(void) {
+  Relay_Counters_t counters;
+  uint32_t         tenths;
+
+  relays.GetCounters(counters);
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    tenths = counters.on_steps[i] / (RELAY_STEPS_PER_HOUR / 10);
+    Serial.print(FM("Relay D"));
+    Serial.print(4 + i);
+    Serial.print(FM(": "));
+    Serial.print(counters.switches[i]);
+    Serial.print(FM(" switches, "));
+    Serial.print(tenths / 10);
+    Serial.print('.');
+    Serial.print((uint8_t)(tenths % 10));
+    Serial.println(FM(" hours on"));
+  }
+}
+
+// Slot of the newest run summary, and its sequence.  Returns false if there are none.
+static bool RunLogNewest(uint8_t& newest, uint8_t& sequence) {
+  uint16_t start;
+  uint8_t  check_value;
+  uint8_t  slot_sequence;
+  bool     found = false;
+
+  for (uint8_t slot = 0; slot < METRICS_RUNS; slot++) {
+    start = RUN_LOG_START + (slot * RUN_LOG_SIZE);
+    if (CheckConfig(start, RUN_LOG_SIZE, check_value)) {
+      slot_sequence = eeprom_read_byte((const uint8_t *)start); // Run_Summary_t.sequence
+      // Newer, allowing for the sequence wrapping.
+      if ((!found) || ((int8_t)(slot_sequence - sequence) > 0)) {
+        newest   = slot;
+        sequence = slot_sequence;
+        found    = true;
+      }
+    }
+  }
+  return found;
+}
+
+// Read a run summary, age 0 is the newest.  Returns false if there isn't one that old.
+bool ReadRunLog(uint8_t age, Run_Summary_t& summary) {
+  uint8_t  newest, sequence;
+  uint16_t start;
+  uint8_t  check_value;
+
+  if ((age >= METRICS_RUNS) || (!RunLogNewest(newest, sequence))) return false;
+
+  start = RUN_LOG_START + (((newest + METRICS_RUNS - age) % METRICS_RUNS) * RUN_LOG_SIZE);
+  if (!CheckConfig(start, RUN_LOG_SIZE, check_value)) return false;
+  eeprom_read_block(&summary, (void *)start, RUN_LOG_SIZE);
+  return (summary.sequence == (uint8_t)(sequence - age));
+}
+
+// Save a run summary, over the oldest.  Sets its sequence.
+void WriteRunLog(Run_Summary_t& summary) {
+  uint8_t  slot     = METRICS_RUNS - 1; // So a blank log starts at slot 0.
+  uint8_t  sequence = 0;
+  uint16_t start;
+
+  if (RunLogNewest(slot, sequence)) sequence++;
+  slot  = (slot + 1) % METRICS_RUNS;
+  start = RUN_LOG_START + (slot * RUN_LOG_SIZE);
+
+  summary.sequence = sequence;
+  // Check byte last, so a reset part way leaves the slot invalid, not wrong.
+  eeprom_update_block(&summary, (void *)start, RUN_LOG_SIZE - 1);
+  CheckConfig(start, RUN_LOG_SIZE, summary.check);
+  eeprom_update_byte((uint8_t *)(start + RUN_LOG_SIZE - 1), summary.check);
+}
+
+// Print the run summaries on the serial port, newest first.
+void PrintRunLog(void) {
+  Run_Summary_t summary;
+
+  for (uint8_t age = 0; age < METRICS_RUNS; age++) {
+    if (ReadRunLog(age, summary)) PrintRunSummary(summary);
+  }
+}
 
 #if 0
 // Setup menu
@@ -39,6 +39,14 @@
 #define THERMOCOUPLE_CS_PIN    9      // PB5
 #define THERMOCOUPLE_CLK_PIN  10      // PB6
 
+// Extra MAX31855 boards share MISO and CLK, each with its own CS.
+// These are on the ICSP header, and must be on Port B.
+#define THERMOCOUPLE_CS2_PIN  14      // PB3
+#define THERMOCOUPLE_CS3_PIN  15      // PB1
+#define THERMOCOUPLE_CS4_PIN  16      // PB2
+
+#define THERMOCOUPLE_CHANNELS  1      // MAX31855 boards fitted (1-4)
+
 /**** User Interface Inputs ****/
 #define BUTTON_TOP            11      // PB7/PCINT7/OC1C/OC0A
 #define ENCODER_C             12      // PD6/T1/OC4D
@@ -7,11 +7,19 @@
 // 1 August 2017         Steven Johnson - heavily modified
 // Modified to run periodically and average samples
 // Modified to only use integer values
+// Modified to read a few bits per refresh
+// Modified to filter with a running sum or exponential average
+// Modified to reject single sample spikes
+// Modified to estimate the rate of temperature change
+// Modified to publish samples, replacing the separate Thermocouple.ino averaging
+// Modified to estimate a lag compensated temperature
+// Modified to support several MAX31855 boards, read one at a time
 
 #ifndef CONTROLEO2_MAX31855_H
 #define CONTROLEO2_MAX31855_H
 
 #include "Arduino.h"
+#include "Filter.h"
 
 #define FAULT_NONE      0x00
 #define FAULT_OPEN      0x41
@@ -22,36 +30,121 @@
 
 #define MAX_TEMPERATURE (700)  // Maximum Temp is 700 Degress, over that is an error.
 
+#define THERMOCOUPLE_BITS_PER_REFRESH (8) // Bits read from the MAX31855 per RefreshTemps (1-32)
+#define THERMOCOUPLE_FILTER_SHIFT     (2) // Boxcar filter averages 2^2 = 4 samples (1 second)
+#define THERMOCOUPLE_IIR_SHIFT        (4) // IIR filter time constant is 2^4 = 16 samples (4 seconds)
+#define THERMOCOUPLE_SPIKE_THRESHOLD  (2*4) // Samples 2 Degrees off the median of their neighbours are spikes
+#define THERMOCOUPLE_RATE_SHIFT       (3) // Rate is fitted over 2^3 = 8 spike filtered samples (2 seconds)
+#define THERMOCOUPLE_DRIFT_RATE       (50) // Rates within +/- 0.5 Degree/second are stable
+#define THERMOCOUPLE_FAULT_THRESHOLD  (4) // Consecutive faults ignored before a fault is reported
+#define THERMOCOUPLE_ALPHA_SHIFT      (2) // Lag estimator temperature gain is 1/2^2
+#define THERMOCOUPLE_BETA_SHIFT       (4) // Lag estimator rate gain is 1/2^4
+#define THERMOCOUPLE_LAG_MS           (0) // Default sensor time constant (milliseconds, 0 = No compensation)
+
+#define THERMOCOUPLE_CONTROL  TC_CONTROL_CHANNEL // Default combination of channels used for control
+
+// How the channels are combined into the sample used for control.
+enum TC_CONTROL {
+  TC_CONTROL_CHANNEL,                  // One channel only
+  TC_CONTROL_MAX,                      // Hottest channel
+  TC_CONTROL_AVERAGE,                  // Average of all channels
+};
+
+// A published Thermocouple sample.
+typedef struct TC_Sample_t {
+  int16_t  temperature;                // Filtered Thermocouple Temperature (Quarter Degrees)
+  int16_t  junction;                   // Filtered Junction Temperature (Quarter Degrees)
+  int16_t  rate;                       // Thermocouple rate of change (0.01 Degree per second)
+  int16_t  compensated;                // Thermocouple Temperature with the sensor lag removed (Quarter Degrees)
+  uint32_t time;                       // millis() when the sample was published
+  uint8_t  fault;                      // FAULT_NONE or the reported fault. Temperatures are stale on a fault.
+  uint8_t  sequence;                   // Incremented for every sample
+} TC_Sample_t;
+
+const __FlashStringHelper* ThermocoupleFaultStr(uint8_t fault);
+
+// A single MAX31855 board.
 class ControLeo2_MAX31855
 {
 public:
     ControLeo2_MAX31855(void);
 
+    void begin(uint8_t cs_pin, uint32_t phase_us);
     void RefreshTemps(void);
+    bool busy(void);
+
+    const TC_Sample_t& getSample(void);
   
     int16_t  readThermocouple(uint8_t places);
     uint8_t  readThermocoupleDrift(void);
+    int16_t  readThermocoupleRate(void);
     
     int16_t  readJunction(uint8_t places);
     uint8_t  readJunctionDrift(void);
 
+    void     setFilterMode(FILTER_MODE mode);
+    void     setLagCompensation(uint16_t tau_ms);
+    uint16_t getSpikeCount(void);
+
     uint8_t  getFault(void);
     const __FlashStringHelper* getFaultStr(void);
+
+    uint16_t getWorstRefreshTime(bool reset);
     
 private:
-    int16_t _RawTemp[4];
-    int16_t _RawJunctionTemp[4];
-    uint8_t _nexttemp;
+    ControLeo2_SpikeFilter                       _Spikes;
+    ControLeo2_Filter<THERMOCOUPLE_FILTER_SHIFT> _Temp;
+    ControLeo2_Filter<THERMOCOUPLE_FILTER_SHIFT> _JunctionTemp;
+    ControLeo2_RateEstimator<THERMOCOUPLE_RATE_SHIFT> _Rate;
+    ControLeo2_AlphaBeta<THERMOCOUPLE_ALPHA_SHIFT, THERMOCOUPLE_BETA_SHIFT> _Lag;
     uint8_t _fault;
+    uint8_t _fault_count;
+    TC_Sample_t _sample;
     uint8_t _Tdrift;
     uint8_t _Jdrift;
 
     uint32_t _last_temp_time;
-    
-    unsigned long readData();
 
-    int16_t  _readTemp(int16_t Temps[], uint8_t places);
+    volatile uint8_t* _cs_port; // Chip Select output register
+    uint8_t  _cs_mask;          // Chip Select bit
+
+    uint32_t _data;             // MAX31855 data word being read
+    uint8_t  _bits_left;        // Bits still to read, 0 = Idle
+    uint16_t _worst_refresh_us; // Longest RefreshTemps call
     
-    uint8_t  _calcDrift(int16_t Temps[]);
+    void     shiftData(uint8_t bits);
+    void     storeSample(uint32_t data);
+
+    uint8_t  _calcDrift(int16_t newest, int16_t oldest);
+};
+
+// All the MAX31855 boards.  They share MISO and CLK, so only one is read at a
+// time, and their reads are staggered evenly over the conversion period.
+class ControLeo2_Thermocouples
+{
+public:
+    ControLeo2_Thermocouples(void);
+
+    void RefreshTemps(void);
+
+    const TC_Sample_t& getSample(void);
+    uint8_t  readThermocoupleDrift(void);
+    const __FlashStringHelper* getFaultStr(void);
+
+    void     setControl(TC_CONTROL control, uint8_t channel);
+    void     setFilterMode(FILTER_MODE mode);
+    void     setLagCompensation(uint16_t tau_ms);
+
+    ControLeo2_MAX31855& channel(uint8_t channel);
+
+private:
+    ControLeo2_MAX31855 _tc[THERMOCOUPLE_CHANNELS];
+    TC_Sample_t _sample;        // Combined sample, used for control
+    TC_CONTROL  _control;
+    uint8_t     _control_channel;
+    uint8_t     _active;        // Channel being read, THERMOCOUPLE_CHANNELS = None
+    uint8_t     _next;          // Next channel offered the bus
+
+    void     combineSamples(void);
 };
 #endif  // CONTROLEO2_MAX31855_H
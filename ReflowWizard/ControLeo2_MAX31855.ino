@@ -4,9 +4,10 @@
 //
 // This is a library for the MAX31855 thermocouple IC used on ControLeo
 // The pin connections are as follows:
-// MISO - D8
-// SCK  - D9
-// CS   - D10
+// MISO - D8  (PB4)
+// CS   - D9  (PB5)
+// SCK  - D10 (PB6)
+// Extra boards share MISO and SCK, with CS on D14 (PB3), D15 (PB1) and D16 (PB2).
 //
 // Written by Peter Easton
 // Released under WTFPL license
@@ -17,6 +18,16 @@
 //                       Modified to maintain state and periodically refresh.
 //                       Temp readings are averaged over the last 4 readings to improve
 //                       read to read error, and also track temp direction.
+//                       Read the MAX31855 through Port B directly, rather than
+//                       with digitalWrite/digitalRead.
+//                       Linearise every reading with integer lookup tables.
+//                       Read the MAX31855 a few bits at a time, over several calls.
+//                       Filter readings with a running sum, or an exponential average.
+//                       Reject single sample spikes before averaging.
+//                       Estimate the rate of temperature change with a least squares fit.
+//                       Publish each sample, for every consumer to read.
+//                       Estimate the temperature ahead of the thermocouple lag.
+//                       Support up to 4 MAX31855 boards, read in turn on a shared bus.
 
 #include "ControLeo2.h"
 
@@ -25,28 +36,94 @@
 #define DRIFT_STABLE (0x0C)
 
 #define THERMOCOUPLE_CONVERSION_RATE (250000) // 250 ms (4 per second. Max rate is 100ms/10 per second)
+#define THERMOCOUPLE_CONVERSION_TIME (100000) // 100 ms, the longest a MAX31855 takes to convert
+
+#if (THERMOCOUPLE_MISO_PIN == 8) && (THERMOCOUPLE_CLK_PIN == 10)
+// Optimised Port B access. CBI/SBI/SBIC are single instructions, so they are interrupt safe.
+#define TC_CLK_HIGH()  PORTB |= _BV(PORTB6)
+#define TC_CLK_LOW()   PORTB &= ~_BV(PORTB6)
+#define TC_MISO_READ() (PINB & _BV(PINB4))
+#else
+#define TC_CLK_HIGH()  digitalWrite(THERMOCOUPLE_CLK_PIN, HIGH)
+#define TC_CLK_LOW()   digitalWrite(THERMOCOUPLE_CLK_PIN, LOW)
+#define TC_MISO_READ() digitalRead(THERMOCOUPLE_MISO_PIN)
+#endif
+
+// Chip select is per board, through its port register.  Read-modify-write, so
+// interrupts are held off, as digitalWrite does.
+#define TC_SELECT()    do { uint8_t sreg = SREG; cli(); *_cs_port &= ~_cs_mask; SREG = sreg; \
+                            __asm__ __volatile__ ("nop"); } while (0) // >100ns CS to first clock
+#define TC_DESELECT()  do { uint8_t sreg = SREG; cli(); *_cs_port |= _cs_mask; SREG = sreg; } while (0)
+
+// Chip select pin of each channel.
+static const uint8_t ThermocoupleCSPins[] = {
+  THERMOCOUPLE_CS_PIN, THERMOCOUPLE_CS2_PIN, THERMOCOUPLE_CS3_PIN, THERMOCOUPLE_CS4_PIN
+};
+
+static_assert((THERMOCOUPLE_CHANNELS >= 1) && (THERMOCOUPLE_CHANNELS <= 4),
+              "THERMOCOUPLE_CHANNELS must be 1 to 4");
+
+
+ControLeo2_MAX31855::ControLeo2_MAX31855(void) : _Spikes(THERMOCOUPLE_SPIKE_THRESHOLD)
+{
+  _cs_port = NULL;
+  _cs_mask = 0;
+  _last_temp_time = 0;
+  _bits_left = 0;
+  _worst_refresh_us = 0;
+  _fault = FAULT_NONE;
+  _fault_count = 0;
+  memset(&_sample, 0x00, sizeof(_sample));
+  _Lag.setLag(THERMOCOUPLE_LAG_MS);
+  _Tdrift = DRIFT_STABLE;
+  _Jdrift = DRIFT_STABLE;
 
+}
 
-ControLeo2_MAX31855::ControLeo2_MAX31855(void)
+/*******************************************************************************
+* Name: begin
+* Description: Set up the pins for this MAX31855, and when it is first read.
+*
+* Parameters  Description
+* =========   ===========
+* cs_pin      Chip Select pin of this MAX31855.
+* phase_us    Delay before the first read (microseconds, less than
+*             THERMOCOUPLE_CONVERSION_RATE).  Reads then follow every
+*             THERMOCOUPLE_CONVERSION_RATE, keeping boards staggered.
+*
+*******************************************************************************/
+void ControLeo2_MAX31855::begin(uint8_t cs_pin, uint32_t phase_us)
 {
   // MAX31855 data output pin
   pinMode(THERMOCOUPLE_MISO_PIN, INPUT);
   // MAX31855 chip select input pin
-  pinMode(THERMOCOUPLE_CS_PIN, OUTPUT);
+  pinMode(cs_pin, OUTPUT);
   // MAX31855 clock input pin
   pinMode(THERMOCOUPLE_CLK_PIN, OUTPUT);
  
   // Default output pins state
-  digitalWrite(THERMOCOUPLE_CS_PIN, HIGH);
+  digitalWrite(cs_pin, HIGH);
   digitalWrite(THERMOCOUPLE_CLK_PIN, LOW);
 
-  memset(_RawTemp,0x00,sizeof(_RawTemp));
-  memset(_RawJunctionTemp,0x00,sizeof(_RawJunctionTemp));
-  _nexttemp = 0;
-  _last_temp_time = 0;
-  _Tdrift = DRIFT_STABLE;
-  _Jdrift = DRIFT_STABLE;
+  _cs_port = portOutputRegister(digitalPinToPort(cs_pin));
+  _cs_mask = digitalPinToBitMask(cs_pin);
+
+  _last_temp_time = micros() - THERMOCOUPLE_CONVERSION_RATE + phase_us;
+}
 
+/*******************************************************************************
+* Name: busy
+* Description: Check if a read of this MAX31855 is in progress.  Other boards
+*              must not be read until it is finished.
+*
+* Return      Description
+* =========   ===========
+* busy        True while this MAX31855 is selected.
+*
+*******************************************************************************/
+bool ControLeo2_MAX31855::busy(void)
+{
+    return (_bits_left != 0);
 }
 
 /*******************************************************************************
@@ -61,13 +138,13 @@ ControLeo2_MAX31855::ControLeo2_MAX31855(void)
 *******************************************************************************/
 int16_t  ControLeo2_MAX31855::readThermocouple(uint8_t places)
 {
-    return _readTemp(_RawTemp, 2-places);     
+    return _Temp.read(2-places);
 }
 
 /*******************************************************************************
 * Name: readThermocoupleDrift
 * Description: Return the Temperature Drift.
-* Plus or minus 0.25 of a degree is considered stable.
+* Plus or minus 0.5 of a degree per second is considered stable.
 *
 *
 * Return      Description
@@ -80,6 +157,24 @@ uint8_t ControLeo2_MAX31855::readThermocoupleDrift(void)
     return _Tdrift;
 }
 
+/*******************************************************************************
+* Name: readThermocoupleRate
+* Description: Return the rate of change of the Thermocouple Temperature.
+* This is a least squares fit over the last 2^THERMOCOUPLE_RATE_SHIFT samples.
+* The fit is made to the spike filtered samples, not the averaged temperature,
+* as the fit does its own smoothing, and isn't then delayed by the average.
+*
+*
+* Return      Description
+* =========   ===========
+* rate        Rate of change, in 0.01 Degree per second (150 = 1.5C/s)
+*
+*******************************************************************************/
+int16_t ControLeo2_MAX31855::readThermocoupleRate(void)
+{
+    return _Rate.rate();
+}
+
 /*******************************************************************************
 * Name: readJunction
 * Description: Return the Junction Temperature
@@ -92,7 +187,7 @@ uint8_t ControLeo2_MAX31855::readThermocoupleDrift(void)
 *******************************************************************************/
 int16_t  ControLeo2_MAX31855::readJunction(uint8_t places)
 {
-    return _readTemp(_RawJunctionTemp, 2-places);    
+    return _JunctionTemp.read(2-places);
 }
 
 /*******************************************************************************
@@ -111,6 +206,22 @@ uint8_t ControLeo2_MAX31855::readJunctionDrift(void)
     return _Jdrift;
 }
 
+/*******************************************************************************
+* Name: getSample
+* Description: Return the latest published sample.  This is the one place
+* every consumer gets temperatures from.  Check sequence to see if it is new.
+*
+*
+* Return      Description
+* =========   ===========
+* sample      Temperature, junction, rate, time, fault and sequence number.
+*
+*******************************************************************************/
+const TC_Sample_t& ControLeo2_MAX31855::getSample(void)
+{
+    return _sample;
+}
+
 /*******************************************************************************
 * Name: getFault
 * Description: get Temperature Reading Fault.
@@ -145,187 +256,542 @@ uint8_t ControLeo2_MAX31855::getFault(void)
 *******************************************************************************/
 const __FlashStringHelper* ControLeo2_MAX31855::getFaultStr(void)
 {
-    if      (_fault == FAULT_NONE)      return FM("");
-    else if (_fault == FAULT_OPEN)      return FM("MISNG");
-    else if (_fault == FAULT_SHORT_GND) return FM("SHT-G");
-    else if (_fault == FAULT_OVERTEMP)  return FM("OVERT");
+    return ThermocoupleFaultStr(_fault);
+}
+
+const __FlashStringHelper* ThermocoupleFaultStr(uint8_t fault)
+{
+    if      (fault == FAULT_NONE)      return FM("");
+    else if (fault == FAULT_OPEN)      return FM("MISNG");
+    else if (fault == FAULT_SHORT_GND) return FM("SHT-G");
+    else if (fault == FAULT_SHORT_VCC) return FM("SHT-V");
+    else if (fault == FAULT_OVERTEMP)  return FM("OVERT");
     return FM("?ERR?");
 }
 
-// Read and average a temperature Array.
-int16_t  ControLeo2_MAX31855::_readTemp(int16_t Temps[],uint8_t shift)
+/*******************************************************************************
+* Name: setFilterMode
+* Description: Select how thermocouple samples are smoothed.
+*              FILTER_BOXCAR gives a short fixed lag, best for reflow ramps.
+*              FILTER_IIR gives heavy smoothing, best for long bakes.
+*
+* Parameters  Description
+* =========   ===========
+* mode        FILTER_BOXCAR or FILTER_IIR
+*
+*******************************************************************************/
+void ControLeo2_MAX31855::setFilterMode(FILTER_MODE mode)
+{
+    _Temp.setMode(mode, THERMOCOUPLE_IIR_SHIFT);
+}
+
+/*******************************************************************************
+* Name: setLagCompensation
+* Description: Set the thermocouple time constant, used for the lag
+*              compensated temperature in each sample.  The thermocouple
+*              reads behind the oven by about time constant * rate, so
+*              compensated temperatures let control stop heating sooner.
+*
+* Parameters  Description
+* =========   ===========
+* tau_ms      Sensor time constant (milliseconds, 0-30000).
+*             0 = No compensation, only the estimated temperature.
+*
+*******************************************************************************/
+void ControLeo2_MAX31855::setLagCompensation(uint16_t tau_ms)
 {
-    int16_t total = 0;
-    total = Temps[0] + Temps[1] + Temps[2] + Temps[3];
-    total = total >> (2+shift);        
+    _Lag.setLag(tau_ms);
+}
 
-    return total;
+/*******************************************************************************
+* Name: getSpikeCount
+* Description: Return the number of thermocouple samples rejected as spikes.
+* A high count means a noisy oven (usually the convection fan).
+*
+*
+* Return      Description
+* =========   ===========
+* count       Rejected samples since power on (stops at 65535)
+*
+*******************************************************************************/
+uint16_t ControLeo2_MAX31855::getSpikeCount(void)
+{
+    return _Spikes.rejected();
 }
 
 // Check Direction of Temperature movement. (+/- 0.5 Degree is Stable)
-uint8_t ControLeo2_MAX31855::_calcDrift(int16_t Temps[])
+// Only used for the junction, the thermocouple uses its rate.
+uint8_t ControLeo2_MAX31855::_calcDrift(int16_t newest, int16_t oldest)
 {
-    uint8_t newest = (_nexttemp - 1) & 0x3; // Newest current temp reading.
-
-    if (Temps[newest] > (Temps[_nexttemp]+2)) {
+    if (newest > (oldest+2)) {
       return DRIFT_UP;
-    } else if (Temps[newest] < (Temps[_nexttemp]-2)) {
+    } else if (newest < (oldest-2)) {
       return DRIFT_DOWN;
     }
     return DRIFT_STABLE;
 }
 
 /*******************************************************************************
-* Name: RefreshTemps
-* Description:  Shift in 32-bit of data from MAX31855 chip. Store Temps and 
-*               Fault flags.  
+* Name: shiftData
+* Description:  Shift in the next bits of the 32-bit MAX31855 data word.
 *               Minimum clock width is 100 ns. No delay is required in this case.
+*
+*               On ControLeo2 MISO and CLK are on Port B, so they are
+*               driven directly rather than through digitalWrite/digitalRead.
+*               Approximate cost of a full 32 bit read at 16MHz:
+*                 digitalWrite/digitalRead : ~6400 cycles (~400us)
+*                 Direct PORTB/PINB        :  ~450 cycles  (~28us)
+*               The hardware SPI (PB1-PB3) is not wired to the MAX31855 on
+*               ControLeo2, so it can not be used.
+*
+*               The MAX31855 stops converting while CS is low, so it is fine
+*               to leave it selected between slices.
+*
+* Parameters  Description
+* =========   ===========
+* bits        Number of bits to shift in (no more than _bits_left)
 *******************************************************************************/
-void ControLeo2_MAX31855::RefreshTemps(void) {
-    int            bitCount;
-    int16_t        temp;
-    uint32_t       current_time = micros();
-    static uint8_t fault_count = 0;
-  
-    if ((current_time - _last_temp_time) >= THERMOCOUPLE_CONVERSION_RATE) {
-        _last_temp_time = current_time;
-        
-        // Clear data 
-        _fault = 0;        
-        temp = 0;
-
-        // Select the MAX31855 chip
-        digitalWrite(THERMOCOUPLE_CS_PIN, LOW);
-        
-        // Shift in Data
-        for (bitCount = 31; bitCount >= 0; bitCount--)
-        {
-            digitalWrite(THERMOCOUPLE_CLK_PIN, HIGH);
-            
-            // If data bit is high
-            if (digitalRead(THERMOCOUPLE_MISO_PIN))
-            {
-                if (bitCount == 31) {
-                    temp = 0xE000;                  // Sign extend
-                } else if (bitCount >= 18) {
-                    temp |= (1 << (bitCount-18));   // 14 Bit Signed number in a 16 bit qty.
-                } else if (bitCount >= 16) {
-                    _fault |= (1 << (bitCount-10)); // Reserved bit Plus Fault bit.
-                } else if (bitCount == 15) {
-                    temp = 0xFE00;                  // Sign extend
-                } else if (bitCount >= 6) {
-                    temp |= (1 << (bitCount-6));    // 10 Bit Signed number in a 16 bit qty.
-                } else if (bitCount >= 4) {
-                    // Ignore bits;                 // Ignore Precision less than 0.25 degrees in junction temp.
-                } else {
-                    _fault |= (1 << bitCount);      // Fault bits
-                }
-            }
+void ControLeo2_MAX31855::shiftData(uint8_t bits) {
+    uint32_t data = _data;
 
-            // Save Temps once fully assembled.
-            if (bitCount == 16) {
-                if (_fault == 0x00) { // Dont store temps when a fault occurs
-                  if (temp <= (MAX_TEMPERATURE*4)) {
-                      _RawTemp[_nexttemp] = temp;  
-                  } else {
-                    _fault = FAULT_OVERTEMP;
-                  }
-                }                  
-                temp = 0;
-            } else if (bitCount == 0) {
-                if (_fault == 0x00) { // Dont store temps when a fault occurs
-                  _RawJunctionTemp[_nexttemp] = temp;    
-                }
-            }
-            
-            digitalWrite(THERMOCOUPLE_CLK_PIN, LOW);
+    _bits_left -= bits;
+
+    // Shift in Data, MSB first.
+    for (; bits > 0; bits--) {
+        TC_CLK_HIGH();
+        data <<= 1;
+        if (TC_MISO_READ()) {
+            data |= 1;
         }
+        TC_CLK_LOW();
+    }
 
-        if (_fault != 0x00) {
-            if (fault_count < 4) {
-              _fault = 0x00; // Only record the fault
-              fault_count++;
-            } else if (fault_count == 5) {
-              _RawTemp[_nexttemp] = (MAX_TEMPERATURE*4) + 1;
-              _nexttemp = (_nexttemp+1) & 0x3; // Step through readings arrays.
-              fault_count++;
-            }
+    _data = data;
+}
+
+/*******************************************************************************
+* Name: storeSample
+* Description:  Decode a complete 32-bit MAX31855 data word. Store Temps and 
+*               Fault flags.  
+*******************************************************************************/
+void ControLeo2_MAX31855::storeSample(uint32_t data) {
+    int16_t temp;
+    int16_t junction = 0;
+    uint8_t fault;
+
+    // D16 = Fault, D17 = Reserved, D3 = Reserved, D2-D0 = SCV, SCG, OC.
+    fault = ((data >> 10) & 0xC0) | (data & 0x0F);
+
+    if (fault == FAULT_NONE) { // Dont store temps when a fault occurs
+        // D31-D18 = 14 Bit Signed thermocouple temperature (0.25 Degree)
+        temp = (int16_t)((int32_t)data >> 18);
+        if (temp <= (MAX_TEMPERATURE*4)) {
+            // D15-D4 = 12 Bit Signed junction temperature (0.0625 Degree)
+            // Ignore Precision less than 0.25 degrees in junction temp.
+            junction = ((int16_t)data) >> 6;
         } else {
-          fault_count = 0;
+            fault = FAULT_OVERTEMP;
+        }
+    }
+
+    if (fault != FAULT_NONE) {
+        // Noisy convection fans can cause spurious faults, so only report a
+        // fault once it persists.  Until then the last good temperature stands.
+        if (_fault_count < THERMOCOUPLE_FAULT_THRESHOLD) {
+          _fault_count++;
+        } else {
+          _fault = fault;
+          _Spikes.reset(); // Don't compare samples across a fault.
+          _Rate.reset();
+          _Lag.reset();
+        }
+    } else {
+      _fault_count = 0;
+      _fault = FAULT_NONE;
+
+      // Linearise the temperature recorded, and remove any spike before averaging.
+      _Temp.add(_Spikes.add(LinearizeThermocouple(temp, junction)));
+      _JunctionTemp.add(junction);
+      // The rate and lag estimators smooth for themselves, so take the
+      // spike filtered sample rather than the average.
+      _Rate.add(millis(), _Temp.newest());
+      _Lag.add(millis(), _Temp.newest());
+    }
+    
+    if (_Rate.rate() > THERMOCOUPLE_DRIFT_RATE) {
+        _Tdrift = DRIFT_UP;
+    } else if (_Rate.rate() < -THERMOCOUPLE_DRIFT_RATE) {
+        _Tdrift = DRIFT_DOWN;
+    } else {
+        _Tdrift = DRIFT_STABLE;
+    }
+    _Jdrift = _calcDrift(_JunctionTemp.newest(), _JunctionTemp.oldest());
+
+    // Publish the new sample.  Only the main loop writes it, so readers don't need
+    // to disable interrupts.
+    _sample.temperature = _Temp.read(0);
+    _sample.junction    = _JunctionTemp.read(0);
+    _sample.rate        = _Rate.rate();
+    _sample.compensated = _Lag.compensated();
+    _sample.time        = millis();
+    _sample.fault       = _fault;
+    _sample.sequence++;
+}
+
+/*******************************************************************************
+* Name: RefreshTemps
+* Description:  Call from the main loop.  Once a conversion is due, the 
+*               MAX31855 is read THERMOCOUPLE_BITS_PER_REFRESH bits per call,
+*               so no single call holds up the loop for the whole transaction.
+*               The sample is only stored once all 32 bits are read.
+*               The worst case time spent in a call is recorded.
+*               Reads are kept on a fixed schedule, so boards stay staggered.
+*******************************************************************************/
+void ControLeo2_MAX31855::RefreshTemps(void) {
+    uint32_t current_time = micros();
+    uint32_t late;
+    uint16_t elapsed;
 
-          // Linearise the temperature recorded.
-          // _RawTemp[_nexttemp] = LinearizeThermocouple(_RawTemp[_nexttemp], _RawJunctionTemp[_nexttemp]); 
-          
-          _nexttemp = (_nexttemp+1) & 0x3; // Step through readings arrays.
+    if (_bits_left == 0) {
+        if ((current_time - _last_temp_time) < THERMOCOUPLE_CONVERSION_RATE) {
+            return; // Nothing to do.
         }
-        
-        _Tdrift = _calcDrift(_RawTemp);
-        _Jdrift = _calcDrift(_RawJunctionTemp);
-        
-        // Deselect MAX31855 chip
-        digitalWrite(THERMOCOUPLE_CS_PIN, HIGH);
+
+        // Keep to the schedule, unless so late that the next read would come
+        // before the MAX31855 has finished converting.
+        late = current_time - _last_temp_time - THERMOCOUPLE_CONVERSION_RATE;
+        if (late > (THERMOCOUPLE_CONVERSION_RATE - THERMOCOUPLE_CONVERSION_TIME)) {
+            _last_temp_time = current_time;
+        } else {
+            _last_temp_time += THERMOCOUPLE_CONVERSION_RATE;
+        }
+
+        // Select the MAX31855 chip, and start a new transaction.
+        TC_SELECT();
+        _data = 0;
+        _bits_left = 32;
+    }
+
+    shiftData(min(_bits_left, THERMOCOUPLE_BITS_PER_REFRESH));
+
+    if (_bits_left == 0) {
+        // Deselect MAX31855 chip, which also starts the next conversion.
+        TC_DESELECT();
+        storeSample(_data);
+    }
+
+    elapsed = micros() - current_time;
+    if (elapsed > _worst_refresh_us) {
+        _worst_refresh_us = elapsed;
     }
 }
 
+/*******************************************************************************
+* Name: getWorstRefreshTime
+* Description: Return the longest time RefreshTemps has taken, since it was
+*              last reset.
+*
+* Parameters  Description
+* =========   ===========
+* reset       True to reset the worst case time after reading it.
+*
+* Return      Description
+* =========   ===========
+* time        Worst case RefreshTemps time (microseconds, 4us resolution)
+*
+*******************************************************************************/
+uint16_t ControLeo2_MAX31855::getWorstRefreshTime(bool reset)
+{
+    uint16_t worst = _worst_refresh_us;
+
+    if (reset) {
+        _worst_refresh_us = 0;
+    }
+    return worst;
+}
+
+#define TC_CJ_MIN_Q      (-32*4)   // Cold junction table starts at -32C (Quarter Degrees)
+#define TC_CJ_STEP_SHIFT (6)       // 16C (64 Quarter Degrees) per cold junction table entry
+#define TC_CJ_ENTRIES    (11)      // -32C to +128C
+
+#define TC_UV_STEP_SHIFT (9)       // 512uV per inverse table entry
+#define TC_UV_MAX        (20644)   // 500C, upper limit of the NIST 0-500C inverse polynomial
+#define TC_UV_ENTRIES    ((TC_UV_MAX >> TC_UV_STEP_SHIFT) + 2) // 0uV to 20992uV, just past 500C
+
+// Type K cold junction equivalent voltage (uV), every 16C from -32C to +128C.
+const int16_t TypeK_CJ_uV[TC_CJ_ENTRIES] PROGMEM = {
+    -1231,  -624,     0,   637,  1285,  1941,  2602,  3267,  3931,  4591,  5247
+};
+
+// Type K temperature (1/64 Degree) every 512uV from 0uV to 20992uV.
+const int16_t TypeK_Temp64[TC_UV_ENTRIES] PROGMEM = {
+        0,   821,  1637,  2443,  3241,  4032,  4820,  5607,  6398,  7193,
+     7993,  8799,  9611, 10427, 11245, 12065, 12885, 13702, 14517, 15329,
+    16136, 16939, 17737, 18532, 19323, 20112, 20898, 21682, 22464, 23246,
+    24025, 24804, 25580, 26356, 27129, 27902, 28673, 29444, 30214, 30984,
+    31753, 32518
+};
+
+/*******************************************************************************
+* Name: LinearizeThermocouple
+* Description:  Correct the MAX31855 reading for the non-linearity of a type K
+*               thermocouple.  The MAX31855 assumes a linear 41.276uV/C.
+*               Uses interpolated lookup tables, generated from the NIST ITS-90
+*               coefficients (http://srdata.nist.gov/its90/download/type_k.tab):
+*                 E = sum(i=0 to 9) c_i t^i + a0 exp(a1 (t - a2)^2) for the
+*                     cold junction voltage (sub-zero coefficients below 0C), and
+*                 t = sum(i=0 to 9) d_i E^i for the inverse (0C to 500C).
+*               Error against the double precision calculation is under 0.25C
+*               from 0C to 500C, inclusive.  The first table step is extended
+*               below 0uV, so a reading at 0C is still converted.
+*               test/test_thermocouple.cpp checks this bound.
+*
+* Parameters  Description
+* =========   ===========
+* temp        Thermocouple Temperature (Quarter Degrees)
+* juncTemp    Cold Junction Temperature (Quarter Degrees)
+*
+* Return      Description
+* =========   ===========
+* temperature Linearised Temperature (Quarter Degrees), or temp if it could
+*             not be converted.
+*******************************************************************************/
 int16_t LinearizeThermocouple(int16_t temp, int16_t juncTemp) {
-  double internalTemp = juncTemp / 4.0;
-  double rawTemp = temp / 4.0;
-  double thermocoupleVoltage= 0;
-  double internalVoltage = 0;
-  double correctedTemp = 0;
-  double totalVoltage = 0;
-  uint8_t i;
-
-  // Steps 1 & 2. Subtract cold junction temperature from the raw thermocouple temperature.
-  thermocoupleVoltage = (rawTemp - internalTemp) * 0.041276;  // C * mv/C = mV
-
-  // Step 3. Calculate the cold junction equivalent thermocouple voltage.
-  // Coefficients and equations available from http://srdata.nist.gov/its90/download/type_k.tab
-  
-  static double c[] = {-0.176004136860E-01,  0.389212049750E-01,  0.185587700320E-04, 
-                       -0.994575928740E-07,  0.318409457190E-09, -0.560728448890E-12,  
-                        0.560750590590E-15, -0.320207200030E-18,  0.971511471520E-22, 
-                       -0.121047212750E-25};
-
-  // Count the the number of coefficients. There are 10 coefficients for positive temperatures (plus three exponential coefficients),
-  // but there are 11 coefficients for negative temperatures.
-  const int cLength = sizeof(c) / sizeof(c[0]);
-
-  // Exponential coefficients. Only used for positive temperatures.
-  const double a0 =  0.118597600000E+00;
-  const double a1 = -0.118343200000E-03;
-  const double a2 =  0.126968600000E+03;
-
-  // From NIST: E = sum(i=0 to n) c_i t^i + a0 exp(a1 (t - a2)^2), where E is the thermocouple voltage in mV and t is the temperature in degrees C.
-  // In this case, E is the cold junction equivalent thermocouple voltage.
-  // Alternative form: C0 + C1*internalTemp + C2*internalTemp^2 + C3*internalTemp^3 + ... + C10*internaltemp^10 + A0*e^(A1*(internalTemp - A2)^2)
-  // This loop sums up the c_i t^i components.
-  for (i = 0; i < cLength; i++) {
-    internalVoltage += c[i] * pow(internalTemp, i);
-  }
-  // This section adds the a0 exp(a1 (t - a2)^2) components.
-  internalVoltage += a0 * exp(a1 * pow((internalTemp - a2), 2));
-
-  // Step 4. Add the cold junction equivalent thermocouple voltage calculated in step 3 to the thermocouple voltage calculated in step 2.
-  totalVoltage = thermocoupleVoltage + internalVoltage;
-
-  if ((totalVoltage > 0) && (totalVoltage < 20.644)) { // Temperature is between 0C and 500C.
-    static double d[] = { 0.000000E+00,  2.508355E+01,  7.860106E-02, 
-                         -2.503131E-01,  8.315270E-02, -1.228034E-02, 
-                          9.804036E-04, -4.413030E-05,  1.057734E-06, 
-                         -1.052755E-08};                  
-    const int dLength = sizeof(d) / sizeof(d[0]);
-    
-    for (i = 0; i < dLength; i++) {
-      correctedTemp += d[i] * pow(totalVoltage, i);
+    int32_t  microVolts;
+    int16_t  offset;
+    uint16_t index;
+    int16_t  lo;
+
+    // Convert the cold junction temperature into its equivalent thermocouple voltage.
+    offset = juncTemp - TC_CJ_MIN_Q;
+    if ((offset < 0) || (offset >= ((TC_CJ_ENTRIES - 1) << TC_CJ_STEP_SHIFT))) {
+        return temp; // Couldn't convert, so just use original temp.
+    }
+    index = offset >> TC_CJ_STEP_SHIFT;
+    offset &= (1 << TC_CJ_STEP_SHIFT) - 1;
+    lo = pgm_read_word_near(TypeK_CJ_uV + index);
+    microVolts = lo + ((((int32_t)((int16_t)pgm_read_word_near(TypeK_CJ_uV + index + 1) - lo) * offset) +
+                        (1 << (TC_CJ_STEP_SHIFT - 1))) >> TC_CJ_STEP_SHIFT);
+
+    // Add the measured thermocouple voltage.  The MAX31855 assumes 41.276uV/C,
+    // which is 10.319uV per quarter degree (~10566/1024).
+    microVolts += (((int32_t)(temp - juncTemp) * 10566) + 512) >> 10;
+
+    if ((microVolts <= -(1 << TC_UV_STEP_SHIFT)) ||
+        (microVolts >= ((int32_t)(TC_UV_ENTRIES - 1) << TC_UV_STEP_SHIFT))) {
+        return temp; // Temperature is well outside 0C to 500C, so just use original temp.
     }
-    correctedTemp *= 4.0; // integer temps have 2 binary digits places.
-  } else {
-    correctedTemp = temp; // Couldn't convert, so just use original temp.
-  }
 
-  return (int16_t)correctedTemp;
+    // Convert the total voltage back to a temperature.  Just below 0uV, the
+    // first step is extrapolated.
+    index = (microVolts < 0) ? 0 : ((uint16_t)microVolts >> TC_UV_STEP_SHIFT);
+    offset = microVolts - ((int32_t)index << TC_UV_STEP_SHIFT);
+    lo = pgm_read_word_near(TypeK_Temp64 + index);
+    lo += (((int32_t)((int16_t)pgm_read_word_near(TypeK_Temp64 + index + 1) - lo) * offset) +
+           (1 << (TC_UV_STEP_SHIFT - 1))) >> TC_UV_STEP_SHIFT;
 
+    return (lo + 8) >> 4; // 1/64 Degree to 1/4 Degree
+}
+
+/*******************************************************************************
+* Name: ControLeo2_Thermocouples
+* Description: Start every fitted MAX31855, with their reads spread evenly
+*              over THERMOCOUPLE_CONVERSION_RATE.
+*******************************************************************************/
+ControLeo2_Thermocouples::ControLeo2_Thermocouples(void)
+{
+    for (uint8_t i = 0; i < THERMOCOUPLE_CHANNELS; i++) {
+        _tc[i].begin(ThermocoupleCSPins[i],
+                     (THERMOCOUPLE_CONVERSION_RATE / THERMOCOUPLE_CHANNELS) * i);
+    }
+    memset(&_sample, 0x00, sizeof(_sample));
+    _control = THERMOCOUPLE_CONTROL;
+    _control_channel = 0;
+    _active = THERMOCOUPLE_CHANNELS;
+    _next = 0;
+}
+
+/*******************************************************************************
+* Name: RefreshTemps
+* Description:  Call from the main loop.  While a MAX31855 is being read, it
+*               has the bus to itself.  Otherwise the next board in turn gets
+*               the chance to start its read, if it is due.
+*               The control sample is updated each time a read completes.
+*******************************************************************************/
+void ControLeo2_Thermocouples::RefreshTemps(void)
+{
+    uint8_t sequence;
+
+    if (_active == THERMOCOUPLE_CHANNELS) {
+        // Bus is free.
+        _active = _next;
+        _next = (_next + 1) % THERMOCOUPLE_CHANNELS;
+    }
+
+    sequence = _tc[_active].getSample().sequence;
+    _tc[_active].RefreshTemps();
+
+    if (!_tc[_active].busy()) {
+        // Read finished (or was not due), free the bus.
+        if ((sequence != _tc[_active].getSample().sequence) &&
+            ((_control != TC_CONTROL_CHANNEL) || (_active == _control_channel))) {
+            combineSamples();
+        }
+        _active = THERMOCOUPLE_CHANNELS;
+    }
 }
- 
 
+/*******************************************************************************
+* Name: combineSamples
+* Description:  Make the control sample from the channel samples, as chosen by
+*               setControl.  Any fault on a combined channel is reported, so a
+*               failed probe can never hide an overheating oven.
+*               Channels not yet read are left out.
+*******************************************************************************/
+void ControLeo2_Thermocouples::combineSamples(void)
+{
+    uint8_t sequence = _sample.sequence;
+    uint8_t fault    = FAULT_NONE;
+    uint8_t count    = 0;
+    int32_t temperature = 0;
+    int32_t junction    = 0;
+    int32_t rate        = 0;
+    int32_t compensated = 0;
+
+    if (_control == TC_CONTROL_CHANNEL) {
+        _sample = _tc[_control_channel].getSample();
+    } else {
+        for (uint8_t i = 0; i < THERMOCOUPLE_CHANNELS; i++) {
+            const TC_Sample_t& sample = _tc[i].getSample();
+
+            if (sample.time == 0) continue; // Not read yet.
+
+            if (sample.fault != FAULT_NONE) {
+                fault = sample.fault;
+            }
+            if ((_control == TC_CONTROL_MAX) &&
+                ((count == 0) || (sample.temperature > _sample.temperature))) {
+                _sample = sample;
+            }
+            temperature += sample.temperature;
+            junction    += sample.junction;
+            rate        += sample.rate;
+            compensated += sample.compensated;
+            count++;
+        }
+
+        if (count == 0) return;
+
+        if (_control == TC_CONTROL_AVERAGE) {
+            _sample.temperature = temperature / count;
+            _sample.junction    = junction / count;
+            _sample.rate        = rate / count;
+            _sample.compensated = compensated / count;
+        }
+        _sample.time  = millis();
+        _sample.fault = fault;
+    }
+    _sample.sequence = sequence + 1;
+}
+
+/*******************************************************************************
+* Name: getSample
+* Description: Return the latest control sample, combined from the channels
+* as set by setControl.  Check sequence to see if it is new.
+*
+*
+* Return      Description
+* =========   ===========
+* sample      Temperature, junction, rate, time, fault and sequence number.
+*
+*******************************************************************************/
+const TC_Sample_t& ControLeo2_Thermocouples::getSample(void)
+{
+    return _sample;
+}
+
+/*******************************************************************************
+* Name: readThermocoupleDrift
+* Description: Return the Temperature Drift of the control sample.
+* Plus or minus 0.5 of a degree per second is considered stable.
+*
+*
+* Return      Description
+* =========   ===========
+* drift       Temp Drift (0x0A = UP, 0x0B = Down, 0x0C = Stable)
+*
+*******************************************************************************/
+uint8_t ControLeo2_Thermocouples::readThermocoupleDrift(void)
+{
+    if (_sample.rate > THERMOCOUPLE_DRIFT_RATE) {
+        return DRIFT_UP;
+    } else if (_sample.rate < -THERMOCOUPLE_DRIFT_RATE) {
+        return DRIFT_DOWN;
+    }
+    return DRIFT_STABLE;
+}
+
+/*******************************************************************************
+* Name: getFaultStr
+* Description: get the control sample Fault as a short string (5 Characters).
+*              See ControLeo2_MAX31855::getFaultStr.
+*******************************************************************************/
+const __FlashStringHelper* ControLeo2_Thermocouples::getFaultStr(void)
+{
+    return ThermocoupleFaultStr(_sample.fault);
+}
+
+/*******************************************************************************
+* Name: setControl
+* Description: Choose which channels make the control sample.
+*
+* Parameters  Description
+* =========   ===========
+* control     TC_CONTROL_CHANNEL, TC_CONTROL_MAX or TC_CONTROL_AVERAGE
+* channel     Channel used by TC_CONTROL_CHANNEL (0 to THERMOCOUPLE_CHANNELS-1)
+*
+*******************************************************************************/
+void ControLeo2_Thermocouples::setControl(TC_CONTROL control, uint8_t channel)
+{
+    _control = control;
+    _control_channel = min(channel, THERMOCOUPLE_CHANNELS-1);
+    combineSamples();
+}
+
+/*******************************************************************************
+* Name: setFilterMode
+* Description: Select how thermocouple samples are smoothed, on every channel.
+*              See ControLeo2_MAX31855::setFilterMode.
+*******************************************************************************/
+void ControLeo2_Thermocouples::setFilterMode(FILTER_MODE mode)
+{
+    for (uint8_t i = 0; i < THERMOCOUPLE_CHANNELS; i++) {
+        _tc[i].setFilterMode(mode);
+    }
+}
+
+/*******************************************************************************
+* Name: setLagCompensation
+* Description: Set the thermocouple time constant, on every channel.
+*              See ControLeo2_MAX31855::setLagCompensation.
+*******************************************************************************/
+void ControLeo2_Thermocouples::setLagCompensation(uint16_t tau_ms)
+{
+    for (uint8_t i = 0; i < THERMOCOUPLE_CHANNELS; i++) {
+        _tc[i].setLagCompensation(tau_ms);
+    }
+}
+
+/*******************************************************************************
+* Name: channel
+* Description: Access a single MAX31855, for its own readings.
+*
+* Parameters  Description
+* =========   ===========
+* channel     0 to THERMOCOUPLE_CHANNELS-1, out of range is the last channel.
+*
+*******************************************************************************/
+ControLeo2_MAX31855& ControLeo2_Thermocouples::channel(uint8_t channel)
+{
+    return _tc[min(channel, THERMOCOUPLE_CHANNELS-1)];
+}
@@ -0,0 +1,95 @@
+// Cooling rate control.
+// Cooling follows a ramp down, from the temperature it starts at, at the Mode's
+// SR_COOL_RATE, to SG_COOL_TEMPERATURE.  A PID controller tracks the ramp, as
+// ReflowTrack does when heating, but its output is the cooling effort:
+//   0 - 100%    the door opens from Armed, up to SR_COOL_DOOROPEN percent of the way to Open.
+//   100 - 200%  the door stays there, and the cooling fan runs, up to SR_COOL_FANSPEED.
+// The PID is given the temperatures negated, so more effort brings them down.
+// An SR_COOL_RATE of 0 doesn't control the rate, the door and fan go straight to their limits.
+// Called from the main loop, while cooling.
+
+#include "PID.h"
+#include "Temperature.h"
+
+#define COOL_KP          (10 * 256)  // 10% per Degree of error
+#define COOL_KI          (51)        // 0.2% per Degree second
+#define COOL_KD          (20 * 256)  // 20% per Degree per second slower than the ramp
+#define COOL_HOLD_ERROR  QDEG(10)    // Ramp waits while the oven is this far behind
+#define COOL_MAX_EFFORT  (200)       // Door fully open, and fan at full
+#define COOL_DOOR_MS     (500)       // Time taken by each door move
+
+ControLeo2_PID coolPID;
+int32_t  coolSetpoint;               // 1/1000ths of a Quarter Degree
+uint8_t  coolRate;                   // 0.1 Degree per second, 0 = uncontrolled
+uint8_t  coolDoor;                   // Door position last set (Degrees)
+uint8_t  coolEffort;
+uint32_t coolLastTime;
+uint8_t  coolLastSequence;
+
+// Door position at an effort.
+uint8_t coolDoorPosition(uint8_t effort) {
+  int16_t armed = readGlobalSetting(SG_SERVO_ARMED_DEG);
+  int32_t open  = ((int32_t)(readGlobalSetting(SG_SERVO_OPEN_DEG) - armed)) * readModeSetting(SR_COOL_DOOROPEN);
+
+  return armed + (open * min(effort, 100)) / 10000;
+}
+
+// Set the door and fan for the cooling effort (percent).
+void coolSetEffort(uint8_t effort) {
+  uint8_t door = coolDoorPosition(effort);
+
+  coolEffort = effort;
+  if (door != coolDoor) {
+    coolDoor = door;
+    setServoPosition(door, COOL_DOOR_MS);
+  }
+  relays.SetRelay(ControLeo2_Relays::RELAY_COOLING_FAN,
+                  (effort > 100) ? (readModeSetting(SR_COOL_FANSPEED) * (effort - 100)) / 100 : 0);
+}
+
+// Start cooling from the sample.
+void coolStart(const TC_Sample_t& sample) {
+  coolRate         = readModeSetting(SR_COOL_RATE);
+  coolSetpoint     = ((int32_t)sample.temperature) * 1000;
+  coolLastTime     = sample.time;
+  coolLastSequence = sample.sequence;
+
+  if (coolRate == 0) {
+    // As fast as possible, open the door at the configured speed.
+    coolDoor   = coolDoorPosition(COOL_MAX_EFFORT);
+    coolEffort = COOL_MAX_EFFORT;
+    setServoPosition(coolDoor, readGlobalSetting(SG_SERVO_OPEN_TIME) * 100);
+    relays.SetRelay(ControLeo2_Relays::RELAY_COOLING_FAN, readModeSetting(SR_COOL_FANSPEED));
+    return;
+  }
+
+  coolPID.setGains(COOL_KP, COOL_KI, COOL_KD);
+  coolPID.setLimits(0, COOL_MAX_EFFORT);
+  coolPID.reset();
+  coolDoor = 0xFF;                   // Not set yet
+  coolSetEffort(0);
+}
+
+// Follow the ramp, on each new sample.
+void coolUpdate(const TC_Sample_t& sample) {
+  int32_t  coolTemp = ((int32_t)qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE))) * 1000;
+  uint16_t dt;
+  qdeg_t   setpoint;
+
+  if ((coolRate == 0) || (sample.sequence == coolLastSequence)) return;
+  coolLastSequence = sample.sequence;
+  dt = sample.time - coolLastTime;
+  coolLastTime = sample.time;
+
+  // Hold the ramp while the oven is well behind it, so the rate is kept once it catches up.
+  if ((((int32_t)sample.temperature) * 1000 - coolSetpoint) < (COOL_HOLD_ERROR * 1000L)) {
+    coolSetpoint -= (((int32_t)coolRate) * 2 * dt) / 5;
+    if (coolSetpoint < coolTemp) coolSetpoint = coolTemp;
+  }
+  setpoint = coolSetpoint / 1000;
+
+  // The rate given is how much slower than the ramp the oven is cooling, so the
+  // derivative doesn't fight the ramp itself.
+  coolSetEffort(coolPID.update(-setpoint, -sample.temperature,
+                               -(sample.rate + (((int16_t)coolRate) * 10)), 0, dt));
+}
@@ -0,0 +1,270 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+// Sample filters, for smoothing temperature readings.
+// All filters work on integer samples, and never re-sum their history, so reads are O(1).
+
+enum FILTER_MODE {
+  FILTER_BOXCAR,        // Average of the last 2^DEPTH_SHIFT samples. Short, fixed lag.
+  FILTER_IIR,           // Exponential (IIR) average, new = old + (sample - old) / 2^shift. Heavy smoothing.
+};
+
+// Ring buffer of the last 2^DEPTH_SHIFT samples, with a running sum.
+// The exponential average is tracked at the same time, so the mode can be switched at any time.
+template <uint8_t DEPTH_SHIFT>
+class ControLeo2_Filter {
+  public:
+    ControLeo2_Filter(void) {
+      _mode      = FILTER_BOXCAR;
+      _iir_shift = DEPTH_SHIFT;
+      reset(0);
+    }
+
+    // Select the filter used by read(). iir_shift sets the smoothing of FILTER_IIR (0-15).
+    void setMode(FILTER_MODE mode, uint8_t iir_shift) {
+      _mode = mode;
+      if (iir_shift != _iir_shift) {
+        _iir = ((int32_t)read(0)) << iir_shift; // Restart the IIR from the current average.
+        _iir_shift = iir_shift;
+      }
+    }
+
+    // Fill the filter with a single value.
+    void reset(int16_t value) {
+      for (uint8_t i = 0; i < DEPTH; i++) {
+        _samples[i] = value;
+      }
+      _sum  = ((int32_t)value) << DEPTH_SHIFT;
+      _iir  = ((int32_t)value) << _iir_shift;
+      _next = 0;
+    }
+
+    // Add a new sample, dropping the oldest.
+    void add(int16_t value) {
+      _sum += value - _samples[_next];
+      _samples[_next] = value;
+      _next = (_next + 1) & (DEPTH - 1);
+
+      _iir += value - (_iir >> _iir_shift);
+    }
+
+    // Filtered value, divided by 2^shift.
+    int16_t read(uint8_t shift) {
+      if (_mode == FILTER_IIR) {
+        return _iir >> (_iir_shift + shift);
+      }
+      return _sum >> (DEPTH_SHIFT + shift);
+    }
+
+    // Raw samples, unfiltered.
+    int16_t newest(void) { return _samples[(_next - 1) & (DEPTH - 1)]; }
+    int16_t oldest(void) { return _samples[_next]; }
+
+  private:
+    static const uint8_t DEPTH = (1 << DEPTH_SHIFT);
+
+    int16_t     _samples[DEPTH];
+    int32_t     _sum;       // Running sum of _samples
+    int32_t     _iir;       // Exponential average * 2^_iir_shift
+    uint8_t     _next;      // Next sample to replace (the oldest)
+    uint8_t     _iir_shift;
+    FILTER_MODE _mode;
+};
+
+// Rejects single sample spikes, such as those caused by convection fan noise.
+// Each sample is held back by one, until its following sample arrives.  It is then
+// replaced by the median of itself and its two neighbours, if it is more than
+// threshold away from that median.  Monotonic changes are never altered.
+class ControLeo2_SpikeFilter {
+  public:
+    ControLeo2_SpikeFilter(int16_t threshold) {
+      _threshold = threshold;
+      _rejected  = 0;
+      _primed    = false;
+    }
+
+    // Add a new sample, and return the previous one with any spike removed.
+    int16_t add(int16_t value) {
+      int16_t median;
+      int16_t middle = _middle;
+
+      if (!_primed) {
+        // No history yet, so the first sample is its own neighbours.
+        _primed = true;
+        _oldest = value;
+        middle  = value;
+      }
+
+      // Median of 3
+      if (_oldest > value) {
+        median = max(value, min(_oldest, middle));
+      } else {
+        median = max(_oldest, min(value, middle));
+      }
+
+      _oldest = middle;
+      _middle = value;
+
+      if (abs(middle - median) > _threshold) {
+        if (_rejected < 0xFFFF) _rejected++;
+        return median;
+      }
+      return middle;
+    }
+
+    // Restart from the next sample.
+    void reset(void) { _primed = false; }
+
+    // Number of samples rejected as spikes.
+    uint16_t rejected(void) { return _rejected; }
+
+  private:
+    int16_t  _oldest;    // Sample before _middle
+    int16_t  _middle;    // Sample being held back
+    int16_t  _threshold; // Maximum distance from the median before a sample is a spike
+    uint16_t _rejected;
+    bool     _primed;
+};
+
+// Rate of change estimator.  Fits a least squares line through the last 2^WINDOW_SHIFT
+// timestamped samples, using integer maths only.
+// Samples are in Quarter Degrees, and the rate is in 0.01 Degree per second.
+template <uint8_t WINDOW_SHIFT>
+class ControLeo2_RateEstimator {
+  public:
+    ControLeo2_RateEstimator(void) {
+      reset();
+    }
+
+    // Forget all samples.
+    void reset(void) {
+      _count = 0;
+      _next  = 0;
+      _rate  = 0;
+    }
+
+    // Add a sample taken at time_ms (millis()), and update the rate.
+    void add(uint32_t time_ms, int16_t value) {
+      _time[_next]  = time_ms >> 2;       // 4ms resolution, wraps every 262 seconds.
+      _value[_next] = value;
+      _next = (_next + 1) & (WINDOW - 1);
+      if (_count < WINDOW) _count++;
+
+      _rate = calcRate();
+    }
+
+    // Rate of change, 0.01 Degree per second.  0 until there are 2 samples.
+    int16_t rate(void) { return _rate; }
+
+  private:
+    static const uint8_t WINDOW = (1 << WINDOW_SHIFT);
+
+    int16_t calcRate(void) {
+      uint8_t  oldest = (_next - _count) & (WINDOW - 1);
+      uint8_t  i, n;
+      int32_t  t, x;
+      int32_t  sum_t  = 0;
+      int32_t  sum_x  = 0;
+      int32_t  sum_tt = 0;
+      int32_t  sum_tx = 0;
+      int32_t  num, den;
+
+      if (_count < 2) return 0;
+
+      // Times and values are relative to the oldest sample, to keep the sums small.
+      for (n = 0, i = oldest; n < _count; n++, i = (i + 1) & (WINDOW - 1)) {
+        t = (uint16_t)(_time[i] - _time[oldest]);
+        x = _value[i] - _value[oldest];
+        sum_t  += t;
+        sum_x  += x;
+        sum_tt += t * t;
+        sum_tx += t * x;
+      }
+
+      // slope = (n.Stx - St.Sx) / (n.Stt - St.St)  Quarter Degrees per 4ms
+      // rate  = slope * 250 (4ms per second) * 25 (0.01 Degree per Quarter Degree)
+      num = (_count * sum_tx) - (sum_t * sum_x);
+      den = ((_count * sum_tt) - (sum_t * sum_t)) / 250;
+      if (den <= 0) return _rate; // All samples at the same time, keep the last rate.
+
+      num = constrain(num, -(0x7FFFFFFFL / 25), (0x7FFFFFFFL / 25));
+      return constrain((num * 25) / den, -32768L, 32767L);
+    }
+
+    uint16_t _time[WINDOW];   // Sample time (4ms units)
+    int16_t  _value[WINDOW];  // Sample value
+    uint8_t  _next;           // Next sample to replace
+    uint8_t  _count;          // Number of samples held
+    int16_t  _rate;           // Last calculated rate
+};
+
+// Alpha-Beta state estimator, tracking temperature and its rate of change.
+// A thermocouple behaves like a first order lag, so what is really being heated is
+// ahead of the reading by about tau * rate.  compensated() adds that back on.
+// Gains are 1/2^ALPHA_SHIFT and 1/2^BETA_SHIFT.  Samples are in Quarter Degrees.
+#define AB_MAX_DT_MS    (2000)          // Longest gap between samples that is still tracked
+#define AB_MAX_TAU_MS   (30000)         // 30 seconds
+#define AB_MAX_RATE     ((50L*4) << 8)  // 50 Degrees per second
+#define AB_MAX_RESIDUAL ((500L*4) << 8) // 500 Degrees
+
+template <uint8_t ALPHA_SHIFT, uint8_t BETA_SHIFT>
+class ControLeo2_AlphaBeta {
+  public:
+    ControLeo2_AlphaBeta(void) {
+      _tau_ms = 0;
+      reset();
+    }
+
+    // Set the sensor time constant (milliseconds, 0 = No compensation).
+    void setLag(uint16_t tau_ms) { _tau_ms = (tau_ms > AB_MAX_TAU_MS) ? AB_MAX_TAU_MS : tau_ms; }
+
+    // Restart from the next sample.
+    void reset(void) {
+      _x = 0;
+      _v = 0;
+      _last_time = 0;
+      _primed = false;
+    }
+
+    // Add a sample taken at time_ms (millis()), and update the estimate.
+    void add(uint32_t time_ms, int16_t value) {
+      int32_t  residual;
+      uint16_t dt;
+
+      if (!_primed) {
+        _primed = true;
+        _x = ((int32_t)value) << 8;
+        _v = 0;
+        _last_time = time_ms;
+        return;
+      }
+
+      dt = constrain(time_ms - _last_time, 1, AB_MAX_DT_MS);
+      _last_time = time_ms;
+
+      // Predict, then correct with the residual.
+      _x += (_v * dt) / 1000;
+      residual = constrain((((int32_t)value) << 8) - _x, -AB_MAX_RESIDUAL, AB_MAX_RESIDUAL);
+      _x += residual >> ALPHA_SHIFT;
+      _v += ((residual * 1000) / dt) >> BETA_SHIFT;
+      _v = constrain(_v, -AB_MAX_RATE, AB_MAX_RATE);
+    }
+
+    // Estimated sensor temperature (Quarter Degrees).
+    int16_t value(void) { return _x >> 8; }
+
+    // Estimated rate of change (0.01 Degree per second).
+    int16_t rate(void) { return (_v * 25) >> 8; }
+
+    // Estimated temperature with the sensor lag removed (Quarter Degrees).
+    int16_t compensated(void) { return (_x + ((_v * _tau_ms) / 1000)) >> 8; }
+
+  private:
+    int32_t  _x;          // Temperature, Quarter Degrees * 256
+    int32_t  _v;          // Rate, Quarter Degrees per second * 256
+    uint32_t _last_time;  // millis() of the last sample
+    uint16_t _tau_ms;     // Sensor time constant
+    bool     _primed;
+};
+
+#endif
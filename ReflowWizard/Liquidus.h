@@ -0,0 +1,58 @@
+#ifndef __LIQUIDUS_H__
+#define __LIQUIDUS_H__
+
+// Time above liquidus (TAL) and peak tracking, for a reflow.
+// The solder is molten while the oven is above the Mode's liquidus temperature.
+// Too long molten, or too hot, harms the boards, so:
+//   cutHeat()      - the elements must be turned off now, or the oven will coast
+//                    past the peak, or stay molten too long.
+//   startCooling() - cooling must start now, to be back below liquidus in time.
+// Once the elements are off, the oven keeps rising at about the rate it was for
+// the dead time plus the time constant of the oven model, the coast.
+// All temperatures are in Quarter Degrees, rates in 0.01 Degree per second.
+
+#include "Model.h"
+#include "Temperature.h"
+
+#define LIQUIDUS_PEAK_BAND  QDEG(5)   // Time at peak is time within 5 Degrees of the peak
+#define LIQUIDUS_COOL_RATE  (100)     // Slowest the oven is expected to cool, once cooling starts (0.01 Degree per second)
+
+class ControLeo2_Liquidus {
+  public:
+    void     begin(uint32_t time, qdeg_t liquidus, qdeg_t peak, uint16_t max_tal, const Oven_Model_t* model);
+    void     update(uint32_t time, qdeg_t temperature, int16_t rate);
+
+    qdeg_t   predictPeak(void);
+    bool     cutHeat(void);
+    bool     startCooling(void);
+
+    qdeg_t   liquidus(void)   { return _liquidus; }
+    qdeg_t   peakTarget(void) { return _peak_target; }
+    uint16_t maxTal(void)     { return _max_tal; }
+
+    uint16_t tal(void)        { return _tal / 1000; }
+    qdeg_t   peak(void)       { return _peak; }
+    uint16_t timeToPeak(void) { return _peak_time / 1000; }
+    uint16_t timeAtPeak(void) { return _at_peak / 1000; }
+    void     report(void);
+
+  private:
+    uint16_t remaining(void);
+
+    bool     _running;
+    qdeg_t   _liquidus;
+    qdeg_t   _peak_target;
+    uint16_t _max_tal;        // seconds
+    uint8_t  _coast;          // seconds
+    uint32_t _start;          // millis() the run started
+    uint32_t _last;           // millis() of the last update
+    qdeg_t   _temperature;
+    int16_t  _rate;
+
+    uint32_t _tal;            // ms above liquidus
+    uint32_t _at_peak;        // ms within LIQUIDUS_PEAK_BAND of the peak target
+    uint32_t _peak_time;      // ms from the start to the peak
+    qdeg_t   _peak;
+};
+
+#endif
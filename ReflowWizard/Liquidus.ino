@@ -0,0 +1,84 @@
+// Time above liquidus and peak tracking, see Liquidus.h
+
+#include "Liquidus.h"
+
+// Start a run at time (millis()), with the Mode's liquidus and peak temperatures,
+// its longest time above liquidus (seconds), and its learnt oven model (NULL = use the defaults).
+void ControLeo2_Liquidus::begin(uint32_t time, qdeg_t liquidus, qdeg_t peak, uint16_t max_tal,
+                                const Oven_Model_t* model) {
+  _running     = true;
+  _liquidus    = liquidus;
+  _peak_target = peak;
+  _max_tal     = max_tal;
+  _coast       = (model != NULL) ? (model->dead_time + model->tau) : (MODEL_DEFAULT_DEAD + MODEL_DEFAULT_TAU);
+  _start       = time;
+  _last        = time;
+  _temperature = 0;
+  _rate        = 0;
+
+  _tal         = 0;
+  _at_peak     = 0;
+  _peak_time   = 0;
+  _peak        = 0;
+}
+
+// Called as often as the reflow runs, with the latest temperature and rate.
+void ControLeo2_Liquidus::update(uint32_t time, qdeg_t temperature, int16_t rate) {
+  uint32_t dt = time - _last;
+
+  if (!_running) return;
+  _last        = time;
+  _temperature = temperature;
+  _rate        = rate;
+
+  if (temperature >= _liquidus) _tal += dt;
+  if (temperature >= qdegSub(_peak_target, LIQUIDUS_PEAK_BAND)) _at_peak += dt;
+  if (temperature > _peak) {
+    _peak      = temperature;
+    _peak_time = time - _start;
+  }
+}
+
+// Peak the oven will coast up to, if the elements are turned off now.
+qdeg_t ControLeo2_Liquidus::predictPeak(void) {
+  if (_rate <= 0) return _temperature;
+  return qdegSaturate(_temperature + ((((int32_t)_rate) * _coast) / 25));
+}
+
+// Seconds more above liquidus, if the elements are turned off and cooling started now.
+uint16_t ControLeo2_Liquidus::remaining(void) {
+  qdeg_t peak = predictPeak();
+
+  if (peak < _liquidus) return 0;
+  return ((_rate > 0) ? _coast : 0) + (uint16_t)((((int32_t)(peak - _liquidus)) * 25) / LIQUIDUS_COOL_RATE);
+}
+
+bool ControLeo2_Liquidus::startCooling(void) {
+  return (_running && ((tal() + remaining()) >= _max_tal));
+}
+
+bool ControLeo2_Liquidus::cutHeat(void) {
+  return (_running && ((predictPeak() >= _peak_target) || startCooling()));
+}
+
+// Print the run's figures, once, at its end.
+void ControLeo2_Liquidus::report(void) {
+  if (!_running) return;
+  _running = false;
+
+  Serial.print(FM("Time above liquidus "));
+  Serial.print(tal());
+  Serial.print(FM("s (max "));
+  Serial.print(_max_tal);
+  Serial.print(FM("s), peak "));
+  Serial.print(qdegToDegrees(_peak));
+  Serial.print(FM("C (target "));
+  Serial.print(qdegToDegrees(_peak_target));
+  Serial.print(FM("C) at "));
+  Serial.print(timeToPeak());
+  Serial.print(FM("s, "));
+  Serial.print(timeAtPeak());
+  Serial.print(FM("s within "));
+  Serial.print(qdegToDegrees(LIQUIDUS_PEAK_BAND));
+  Serial.println(FM("C of the target"));
+}
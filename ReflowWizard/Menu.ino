@@ -30,6 +30,10 @@ float floatValue = 999.99;
 #define GS_ITEM_FIRST (20)
 #define GS_ITEM(X)    (GS_ITEM_FIRST + X)
 
+// Test Hardware Items (TH)
+#define TH_ITEM_FIRST (60)
+#define TH_ITEM(X)    (TH_ITEM_FIRST + X)
+
 // Menu Headers --------
 const PROGMEM MD_Menu::mnuHeader_t mnuHdr[] =
 {
@@ -37,7 +41,7 @@ const PROGMEM MD_Menu::mnuHeader_t mnuHdr[] =
   { MENU(0), "Reflow Wizard V3", MM_ITEM(0), MM_ITEM(5), 0 }, 
   { MENU(1), "Configure Menu  ", GS_ITEM(0), GS_ITEM(10), 0 },
   { MENU(2), "Add/Edit Mode   ", 0, 1, 0 },
-  { MENU(3), "Test HW Menu    ", 0, 1, 0 },
+  { MENU(3), "Test HW Menu    ", TH_ITEM(0), TH_ITEM(7), 0 },
   { MENU(4), "Learn Menu      ", 0, 1, 0 },
   { MENU(5), "Reflow Menu     ", 0, 1, 0 },
   { MENU(6), "Bake Menu       ", 0, 1, 0 },
@@ -61,6 +65,9 @@ FLASH_STRING(DARM_HELP) = "Set Armed or Pre Opening Position of the Door Open Se
 FLASH_STRING(DOPN_HELP) = "Set Fully Open Position of the Door Open Servo";
 FLASH_STRING(DOPT_HELP) = "Set Time to Open Door, in 10ths of a second";
 
+FLASH_STRING(RSWT_HELP) = "Times this Relay has been turned on";
+FLASH_STRING(RHRS_HELP) = "Hours this Relay has been on";
+
 
 // Menu Items ----------
 const PROGMEM MD_Menu::mnuItem_t mnuItm[] =
@@ -87,6 +94,16 @@ const PROGMEM MD_Menu::mnuItem_t mnuItm[] =
   { GS_ITEM(9),  "D:Open  \x08", MD_Menu::MNU_INPUT, GS_ITEM(9),  DOPN_HELP}, // Door Open 100%
   { GS_ITEM(10), "D:OpnTime",    MD_Menu::MNU_INPUT, GS_ITEM(10), DOPT_HELP}, // Door Open 100%
 
+  // Test Hardware submenu, Relay wear
+  { TH_ITEM(0),  "D4:Switch",    MD_Menu::MNU_INPUT, TH_ITEM(0),  RSWT_HELP}, // D4 Times turned on
+  { TH_ITEM(1),  "D4:Hours ",    MD_Menu::MNU_INPUT, TH_ITEM(1),  RHRS_HELP}, // D4 Hours on
+  { TH_ITEM(2),  "D5:Switch",    MD_Menu::MNU_INPUT, TH_ITEM(2),  RSWT_HELP}, // D5 Times turned on
+  { TH_ITEM(3),  "D5:Hours ",    MD_Menu::MNU_INPUT, TH_ITEM(3),  RHRS_HELP}, // D5 Hours on
+  { TH_ITEM(4),  "D6:Switch",    MD_Menu::MNU_INPUT, TH_ITEM(4),  RSWT_HELP}, // D6 Times turned on
+  { TH_ITEM(5),  "D6:Hours ",    MD_Menu::MNU_INPUT, TH_ITEM(5),  RHRS_HELP}, // D6 Hours on
+  { TH_ITEM(6),  "D7:Switch",    MD_Menu::MNU_INPUT, TH_ITEM(6),  RSWT_HELP}, // D7 Times turned on
+  { TH_ITEM(7),  "D7:Hours ",    MD_Menu::MNU_INPUT, TH_ITEM(7),  RHRS_HELP}, // D7 Hours on
+
 #if 0  
   
   // Serial Setup
@@ -128,6 +145,15 @@ const PROGMEM MD_Menu::mnuInput_t mnuInp[] =
   { GS_ITEM(8),  "     ", MD_Menu::INP_INT16, mnuGSValueRqst,  3,     {.range = { .min= 0, .max= 180, .base=10 } }}, // Door Armed (Closed, but ready to open)
   { GS_ITEM(9),  "     ", MD_Menu::INP_INT16, mnuGSValueRqst,  3,     {.range = { .min= 0, .max= 180, .base=10 } }}, // Door Open 100%
   { GS_ITEM(10), "     ", MD_Menu::INP_FLOAT, mnuGSValueRqst,  4,     {.range = { .min= 0, .max= 255, .base=1  } }}, // 0-25.5 Seconds.
+
+  { TH_ITEM(0),  "     ", MD_Menu::INP_INT32, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=10 } }}, // D4 Times turned on
+  { TH_ITEM(1),  "     ", MD_Menu::INP_FLOAT, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=1  } }}, // D4 Hours on (10ths)
+  { TH_ITEM(2),  "     ", MD_Menu::INP_INT32, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=10 } }}, // D5 Times turned on
+  { TH_ITEM(3),  "     ", MD_Menu::INP_FLOAT, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=1  } }}, // D5 Hours on (10ths)
+  { TH_ITEM(4),  "     ", MD_Menu::INP_INT32, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=10 } }}, // D6 Times turned on
+  { TH_ITEM(5),  "     ", MD_Menu::INP_FLOAT, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=1  } }}, // D6 Hours on (10ths)
+  { TH_ITEM(6),  "     ", MD_Menu::INP_INT32, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=10 } }}, // D7 Times turned on
+  { TH_ITEM(7),  "     ", MD_Menu::INP_FLOAT, mnuRelayLogRqst, 7,     {.range = { .min= 0, .max= 9999999, .base=1  } }}, // D7 Hours on (10ths)
   
 #if 0  
   
@@ -194,6 +220,26 @@ void *mnuGSValueRqst(MD_Menu::mnuId_t id, MD_Menu::cdValueOp_t op)
   return(nullptr);
 }
 
+// Value request callback for the Relay wear counters.
+// Read only, any edit is ignored.
+void *mnuRelayLogRqst(MD_Menu::mnuId_t id, MD_Menu::cdValueOp_t op)
+{
+  Relay_Counters_t counters;
+  uint8_t item  = id - TH_ITEM_FIRST;
+  uint8_t relay = item >> 1;
+
+  if (op == MD_Menu::VAL_OP_GET) {
+    relays.GetCounters(counters);
+    if (item & 1) {
+      tempConf32 = counters.on_steps[relay] / (RELAY_STEPS_PER_HOUR / 10); // 10ths of an hour
+    } else {
+      tempConf32 = counters.switches[relay];
+    }
+    return &tempConf32;
+  }
+  return(nullptr);
+}
+
 #if 0
 // Callback code for menu set/get input values
 void *mnuLValueRqst(MD_Menu::mnuId_t id, bool bGet)
@@ -0,0 +1,58 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+// Run quality metrics.
+// Worked out as the reflow runs, once a second, in constant memory, and kept
+// in EEPROM for the last METRICS_RUNS runs, so a bad run can be spotted without
+// going through its log.
+// The target curve is the profile trajectory, profileSetpoint() in Config.ino.
+
+#include "Liquidus.h"
+#include "Temperature.h"
+
+#define METRICS_RUNS       (3)      // Run summaries kept in EEPROM
+#define METRICS_NO_TARGET  (0xFF)   // Phase given while cooling, there is no target to compare with
+#define METRICS_MAX_ERROR  QDEG(250)// Largest error summed, so the sum can't overflow
+#define METRICS_SHOW_MS    (10000)  // Time the summary is shown at the end of a run
+
+// Run_Summary_t flags, a run with any set is a bad one.
+#define RUN_ABORTED        (0x01)   // The run didn't complete
+#define RUN_TAL_LONG       (0x02)   // Longer above liquidus than SR_LIQUIDUS_MAXTIME
+#define RUN_PEAK_HIGH      (0x04)   // Peak more than LIQUIDUS_PEAK_BAND over SR_REFLOW_MAXTEMP
+#define RUN_NOT_MELTED     (0x08)   // Peak never reached liquidus
+
+typedef struct Run_Summary_t {
+  uint8_t  sequence;                // Highest is the newest
+  uint8_t  mode;                    // Mode run
+  uint8_t  flags;                   // RUN_*
+  uint8_t  rms;                     // RMS deviation from the target curve (Quarter Degrees)
+  uint8_t  overshoot[3];            // Most above the target in Presoak, Soak and Reflow (Quarter Degrees)
+  int8_t   max_rate;                // Fastest rise (0.1 Degree per second)
+  int8_t   min_rate;                // Fastest fall (0.1 Degree per second)
+  uint8_t  soak;                    // Seconds between the Presoak and Soak end temperatures
+  uint8_t  tal;                     // Seconds above liquidus
+  uint8_t  peak;                    // Peak temperature (Degrees / 2)
+  uint8_t  check;                   // See CheckConfig, Always Last Element
+} Run_Summary_t;
+
+class ControLeo2_RunMetrics {
+  public:
+    void begin(uint32_t time, qdeg_t soak_low, qdeg_t soak_high);
+    void update(uint32_t time, uint8_t phase, qdeg_t target, qdeg_t temperature, int16_t rate);
+    bool finish(uint8_t mode, bool completed, ControLeo2_Liquidus& liquidus, Run_Summary_t& summary);
+
+  private:
+    bool     _running;
+    uint32_t _last;                 // millis() of the last second measured
+    qdeg_t   _soak_low;
+    qdeg_t   _soak_high;
+
+    uint32_t _sum_squares;          // Of the error, Quarter Degrees squared
+    uint16_t _samples;
+    qdeg_t   _overshoot[3];
+    int16_t  _max_rate;             // 0.01 Degree per second
+    int16_t  _min_rate;
+    uint16_t _soak;                 // seconds
+};
+
+#endif
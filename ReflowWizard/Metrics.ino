@@ -0,0 +1,127 @@
+// Run quality metrics, see Metrics.h
+
+#include "Metrics.h"
+#include "Temperature.h"
+
+// Integer square root.
+static uint16_t metricsSqrt(uint32_t value) {
+  uint32_t root = 0;
+  uint32_t bit  = 1UL << 30;
+
+  while (bit > value) bit >>= 2;
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root   = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+// Start a run, at time (millis()).  Soak is the time spent between soak_low and soak_high (Quarter Degrees).
+void ControLeo2_RunMetrics::begin(uint32_t time, qdeg_t soak_low, qdeg_t soak_high) {
+  _running     = true;
+  _last        = time;
+  _soak_low    = soak_low;
+  _soak_high   = soak_high;
+
+  _sum_squares = 0;
+  _samples     = 0;
+  memset(_overshoot, 0, sizeof(_overshoot));
+  _max_rate    = 0;
+  _min_rate    = 0;
+  _soak        = 0;
+}
+
+// Called as often as the reflow runs.  phase is 0 - 2 for Presoak - Reflow (Waiting counts as
+// Reflow), or METRICS_NO_TARGET.  Temperatures are in Quarter Degrees, the rate in 0.01 Degree per second.
+void ControLeo2_RunMetrics::update(uint32_t time, uint8_t phase, qdeg_t target, qdeg_t temperature, int16_t rate) {
+  qdeg_t error;
+
+  if ((!_running) || ((time - _last) < 1000)) return;
+  _last += 1000;
+
+  if (rate > _max_rate) _max_rate = rate;
+  if (rate < _min_rate) _min_rate = rate;
+  if ((temperature >= _soak_low) && (temperature < _soak_high) && (rate >= 0) && (_soak < 255)) _soak++;
+
+  if (phase > 2) return;
+  error = constrain(qdegSub(temperature, target), -METRICS_MAX_ERROR, METRICS_MAX_ERROR);
+  if (error > _overshoot[phase]) _overshoot[phase] = error;
+  _sum_squares += ((int32_t)error) * error;
+  _samples++;
+}
+
+// Summarise the run, once, at its end.  Returns false if there was no run.
+bool ControLeo2_RunMetrics::finish(uint8_t mode, bool completed, ControLeo2_Liquidus& liquidus, Run_Summary_t& summary) {
+  if (!_running) return false;
+  _running = false;
+
+  summary.mode  = mode;
+  summary.flags = 0;
+  if (!completed)                                                           summary.flags |= RUN_ABORTED;
+  if (liquidus.tal() > liquidus.maxTal())                                   summary.flags |= RUN_TAL_LONG;
+  if (liquidus.peak() > qdegAdd(liquidus.peakTarget(), LIQUIDUS_PEAK_BAND)) summary.flags |= RUN_PEAK_HIGH;
+  if (liquidus.peak() < liquidus.liquidus())                                summary.flags |= RUN_NOT_MELTED;
+
+  summary.rms = min(metricsSqrt((_samples != 0) ? (_sum_squares / _samples) : 0), 255);
+  for (uint8_t i = 0; i < 3; i++) summary.overshoot[i] = min(_overshoot[i], 255);
+  summary.max_rate = constrain(_max_rate / 10, -128, 127);
+  summary.min_rate = constrain(_min_rate / 10, -128, 127);
+  summary.soak     = _soak;
+  summary.tal      = min(liquidus.tal(), 255);
+  summary.peak     = constrain(qdegToDegrees(liquidus.peak()) / 2, 0, 255);
+  return true;
+}
+
+// Print a rate (0.1 Degree per second).
+static void printRunRate(int8_t rate) {
+  if (rate < 0) Serial.print('-');
+  Serial.print(abs(rate) / 10);
+  Serial.print('.');
+  Serial.print(abs(rate) % 10);
+}
+
+void PrintRunSummary(const Run_Summary_t& summary) {
+  Serial.print(FM("Run "));
+  Serial.print(summary.sequence);
+  Serial.print(FM(", Mode "));
+  Serial.print(summary.mode);
+  Serial.print(FM(": RMS error "));
+  printQdeg(summary.rms);
+  Serial.print(FM("C, overshoot "));
+  for (uint8_t i = 0; i < 3; i++) {
+    printQdeg(summary.overshoot[i]);
+    Serial.print((i < 2) ? FM("/") : FM("C, rate "));
+  }
+  printRunRate(summary.max_rate);
+  Serial.print(FM(" to "));
+  printRunRate(summary.min_rate);
+  Serial.print(FM("C/s, soak "));
+  Serial.print(summary.soak);
+  Serial.print(FM("s, TAL "));
+  Serial.print(summary.tal);
+  Serial.print(FM("s, peak "));
+  Serial.print(summary.peak * 2);
+  Serial.print('C');
+  if (summary.flags & RUN_ABORTED)    Serial.print(FM(", aborted"));
+  if (summary.flags & RUN_TAL_LONG)   Serial.print(FM(", TAL too long"));
+  if (summary.flags & RUN_PEAK_HIGH)  Serial.print(FM(", peak too high"));
+  if (summary.flags & RUN_NOT_MELTED) Serial.print(FM(", not melted"));
+  Serial.println();
+}
+
+// Show the summary on the LCD for METRICS_SHOW_MS.
+// The temperature overlay uses the start of the second line.
+void ShowRunSummary(const Run_Summary_t& summary) {
+  char line[17];
+
+  sprintf(line, "Peak %3u TAL%3us", summary.peak * 2, summary.tal);
+  lcd.PrintStr(0, 0, line);
+  sprintf(line, "RMS%2u.%02u %s", qdegToDegrees(summary.rms), (summary.rms & 3) * 25, (summary.flags != 0) ? "!!" : "OK");
+  lcd.PrintStr(5, 1, line);
+  holdMessage(METRICS_SHOW_MS);
+}
@@ -0,0 +1,81 @@
+#ifndef __MODEL_H__
+#define __MODEL_H__
+
+// First order plus dead time model of the oven, learnt for each Mode.
+//   heat' = (sum(gain[i] * duty[i](t - dead_time)) - heat) / tau
+//   T'    = heat - loss * (T - ambient)
+// heat is the rate of rise the elements are giving.  The model is stepped once
+// a second, with temperatures in 0.01 Degree, and rates in 0.01 Degree per second.
+// It is used to predict the phase power needed to reach a temperature in a given
+// time, so a phase can be driven to its end temperature at the profile time.
+
+#include "Temperature.h"
+
+#define MODEL_ELEMENTS        (3)     // Bottom, Boost, Top
+#define MODEL_HISTORY         (32)    // Seconds of duty history kept, longest dead time (Power of 2)
+#define MODEL_HORIZON         (40)    // Most seconds predicted ahead, longer than the longest dead time
+#define MODEL_RISE_RATE       (10)    // 0.1 Degree per second, the oven has started heating
+#define MODEL_TAU_RATE        (50)    // 0.5 Degree per second, least rate tau is measured from
+#define MODEL_LOSS_SHIFT      (16)    // loss is in 1/65536ths
+#define MODEL_PRIOR_WEIGHT    (100)   // Seconds of data the previous model is worth in a fit
+#define MODEL_MAX_SAMPLES     (1000)  // Most seconds fitted, so the sums can't overflow
+#define MODEL_MAX_RATE        (1000)  // Largest rate fitted (0.01 Degree per second)
+#define MODEL_FIT_SWEEPS      (100)   // Gauss-Seidel iterations of the fit
+#define MODEL_FIT_BITS        (14)    // Normal equations are scaled below 2^14
+#define MODEL_FIT_SHIFT       (12)    // Fitted coefficients are in 1/4096ths
+#define MODEL_FIT_MAX         (16383) // Largest fitted coefficient (gain 3199, loss 5242)
+
+#define MODEL_DEFAULT_GAIN    (100)   // 1 Degree per second at 100%, per element
+#define MODEL_DEFAULT_LOSS    (218)   // 1/300 per second
+#define MODEL_DEFAULT_TAU     (20)    // seconds
+#define MODEL_DEFAULT_DEAD    (5)     // seconds
+
+typedef struct Oven_Model_t {
+  uint16_t gain[MODEL_ELEMENTS];      // Rate of rise each element gives at 100% duty (0.01 Degree per second)
+  uint16_t loss;                      // Loss coefficient, fraction of (T - ambient) lost a second (1/65536ths)
+  uint8_t  tau;                       // Time constant of element heat reaching the oven (seconds)
+  uint8_t  dead_time;                 // Time before an element change is seen at all (seconds)
+  uint8_t  check;                     // See CheckConfig, Always Last Element
+} Oven_Model_t;
+
+class ControLeo2_OvenModel {
+  public:
+    ControLeo2_OvenModel(void);
+
+    void    begin(const Oven_Model_t* model, qdeg_t ambient);
+    bool    valid(void) { return _valid; }
+    const Oven_Model_t& model(void) { return _model; }
+
+    void    second(qdeg_t temperature, int16_t rate, const uint8_t duty[MODEL_ELEMENTS]);
+    uint8_t predictPower(qdeg_t temperature, qdeg_t target, uint8_t horizon,
+                         const uint8_t duty[MODEL_ELEMENTS], uint8_t max_power);
+
+    void    learn(bool enable) { _learning = enable; }
+    bool    fit(Oven_Model_t& model);
+
+  private:
+    int32_t heat(const uint8_t duty[MODEL_ELEMENTS]);
+    int32_t loss(int32_t temperature);
+
+    Oven_Model_t _model;
+    bool     _valid;
+    int32_t  _ambient;                           // 0.01 Degree
+    int32_t  _heat;                              // Estimated heat, 0.01 Degree per second
+    uint8_t  _history[MODEL_HISTORY][MODEL_ELEMENTS]; // Duty applied each second, newest at _next - 1
+    uint8_t  _next;
+    uint16_t _seconds;                           // Since begin()
+
+    // Learning
+    bool     _learning;
+    uint16_t _heat_on;                           // Second the elements were first turned on (0 = not yet)
+    uint16_t _heat_off;                          // Second the elements were turned off after heating (0 = not yet)
+    int16_t  _rate_off;                          // Rate when they were turned off
+    uint8_t  _dead_time;                         // Measured, 0 = not yet
+    uint8_t  _tau;                               // Measured, 0 = not yet
+    int16_t  _lagged[MODEL_ELEMENTS];            // Duty, delayed and lagged as the oven sees it (1/256ths %)
+    int32_t  _a[MODEL_ELEMENTS + 1][MODEL_ELEMENTS + 1]; // Least squares sums (normal equations)
+    int32_t  _b[MODEL_ELEMENTS + 1];
+    uint16_t _samples;
+};
+
+#endif
@@ -0,0 +1,216 @@
+// Oven model, see Model.h
+// Learnt during a reflow, from the duty cycles applied and the temperature seen:
+//   dead_time - from the elements first turning on, to the oven heating.
+//   tau       - from the elements turning off, to the rate falling to 37%,
+//               if they were giving a clear rise when turned off.
+//   gain/loss - least squares fit of rate = sum(gain[i] * duty[i]) - loss * (T - ambient),
+//               with the duties delayed by dead_time and lagged by tau.
+// The fit starts from the previous model, so each run refines it.
+// The fit is all 32 bit integer.  Duties are summed in 1/8ths %, temperatures in
+// half Degrees, and the fitted coefficients are 1/4096ths of a rate per unit.
+
+#include "Model.h"
+
+#define MODEL_HISTORY_MASK (MODEL_HISTORY - 1)
+
+static_assert((MODEL_HISTORY & MODEL_HISTORY_MASK) == 0, "MODEL_HISTORY must be a power of 2");
+
+ControLeo2_OvenModel::ControLeo2_OvenModel(void) {
+  begin(NULL, 0);
+}
+
+// Start a run, from the learnt model (NULL = use the defaults), at ambient (Quarter Degrees).
+void ControLeo2_OvenModel::begin(const Oven_Model_t* model, qdeg_t ambient) {
+  if (model != NULL) {
+    _model = *model;
+    _valid = true;
+  } else {
+    for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) _model.gain[i] = MODEL_DEFAULT_GAIN;
+    _model.loss      = MODEL_DEFAULT_LOSS;
+    _model.tau       = MODEL_DEFAULT_TAU;
+    _model.dead_time = MODEL_DEFAULT_DEAD;
+    _valid = false;
+  }
+  if (_model.tau == 0) _model.tau = 1;
+  if (_model.dead_time >= MODEL_HISTORY) _model.dead_time = MODEL_HISTORY - 1;
+
+  _ambient = ((int32_t)ambient) * 25;
+  _heat    = 0;
+  memset(_history, 0, sizeof(_history));
+  _next    = 0;
+  _seconds = 0;
+
+  _learning  = false;
+  _heat_on   = 0;
+  _heat_off  = 0;
+  _rate_off  = 0;
+  _dead_time = 0;
+  _tau       = 0;
+  memset(_lagged, 0, sizeof(_lagged));
+  memset(_a, 0, sizeof(_a));
+  memset(_b, 0, sizeof(_b));
+  _samples   = 0;
+}
+
+// Rate of rise the model gives for the duties (0.01 Degree per second).
+int32_t ControLeo2_OvenModel::heat(const uint8_t duty[MODEL_ELEMENTS]) {
+  int32_t h = 0;
+
+  for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) {
+    h += ((int32_t)_model.gain[i]) * duty[i];
+  }
+  return h / 100;
+}
+
+// Rate of heat loss at temperature (0.01 Degree) (0.01 Degree per second).
+int32_t ControLeo2_OvenModel::loss(int32_t temperature) {
+  return ((temperature - _ambient) * (int32_t)_model.loss) >> MODEL_LOSS_SHIFT;
+}
+
+// Called once a second, with the temperature (Quarter Degrees), its rate (0.01 Degree per second)
+// and the duties now applied to the elements.
+void ControLeo2_OvenModel::second(qdeg_t temperature, int16_t rate, const uint8_t duty[MODEL_ELEMENTS]) {
+  int32_t  t = ((int32_t)temperature) * 25;
+  uint16_t total = 0;
+  uint8_t  tau;
+  uint8_t  i;
+  int16_t  x[MODEL_ELEMENTS + 1];
+
+  _seconds++;
+  memcpy(_history[_next], duty, MODEL_ELEMENTS);
+  _next = (_next + 1) & MODEL_HISTORY_MASK;
+
+  // Track the heat the elements are giving, from the model, corrected by the measured rate.
+  _heat += (heat(_history[(_next - 1 - _model.dead_time) & MODEL_HISTORY_MASK]) - _heat) / _model.tau;
+  _heat += ((rate + loss(t)) - _heat) / 4;
+
+  if (!_learning) return;
+
+  for (i = 0; i < MODEL_ELEMENTS; i++) total += duty[i];
+
+  if ((_heat_on == 0) && (total != 0)) _heat_on = _seconds;
+
+  if ((_heat_on != 0) && (_dead_time == 0) && (rate >= MODEL_RISE_RATE)) {
+    _dead_time = constrain(_seconds - _heat_on, 1, MODEL_HISTORY - 1);
+  }
+
+  if ((_dead_time != 0) && (_heat_off == 0) && (total == 0)) {
+    _heat_off = _seconds;
+    _rate_off = rate;
+  }
+
+  if ((_heat_off != 0) && (_tau == 0) && (_rate_off >= MODEL_TAU_RATE) &&
+      ((((int32_t)rate) * 100) <= (((int32_t)_rate_off) * 37))) {
+    _tau = constrain((int16_t)(_seconds - _heat_off) - _dead_time, 1, 255);
+  }
+
+  if ((_dead_time == 0) || (_samples >= MODEL_MAX_SAMPLES)) return;
+
+  // Duties as the oven sees them now, and the fit sums.
+  tau = (_tau != 0) ? _tau : _model.tau;
+  for (i = 0; i < MODEL_ELEMENTS; i++) {
+    _lagged[i] += ((((int16_t)_history[(_next - 1 - _dead_time) & MODEL_HISTORY_MASK][i]) << 8) - _lagged[i]) / tau;
+    x[i] = _lagged[i] >> 5;
+  }
+  x[MODEL_ELEMENTS] = (_ambient - t) / 50;
+  rate = constrain(rate, -MODEL_MAX_RATE, MODEL_MAX_RATE);
+
+  for (i = 0; i <= MODEL_ELEMENTS; i++) {
+    for (uint8_t j = 0; j <= MODEL_ELEMENTS; j++) _a[i][j] += ((int32_t)x[i]) * x[j];
+    _b[i] += ((int32_t)x[i]) * rate;
+  }
+  _samples++;
+}
+
+// Phase power (percent of duty) which will bring the oven to target (Quarter Degrees),
+// horizon seconds from now.  Power changes only show after the dead time, so the
+// horizon should be longer.
+uint8_t ControLeo2_OvenModel::predictPower(qdeg_t temperature, qdeg_t target, uint8_t horizon,
+                                           const uint8_t duty[MODEL_ELEMENTS], uint8_t max_power) {
+  int32_t full = heat(duty);
+  int32_t t[2];
+  int32_t h;
+  int32_t u;
+  int32_t power;
+
+  // The prediction is linear in power, so predict for 0% and 100%, and interpolate.
+  for (uint8_t p = 0; p < 2; p++) {
+    t[p] = ((int32_t)temperature) * 25;
+    h = _heat;
+    for (uint8_t k = 1; k <= horizon; k++) {
+      if (k <= _model.dead_time) {
+        u = heat(_history[(_next - 1 - _model.dead_time + k) & MODEL_HISTORY_MASK]);
+      } else {
+        u = p ? full : 0;
+      }
+      h += (u - h) / _model.tau;
+      t[p] += h - loss(t[p]);
+    }
+  }
+
+  // Power can't change the temperature within the horizon.
+  if (t[1] <= t[0]) return min(100, max_power);
+
+  power = ((((int32_t)target) * 25 - t[0]) * 100) / (t[1] - t[0]);
+  return constrain(power, 0, max_power);
+}
+
+// Fit the model to the run so far.  The fit is solved in place, in the sums, so uses them up.
+// Returns false, and leaves the model alone, if the run didn't give enough to fit.
+bool ControLeo2_OvenModel::fit(Oven_Model_t& model) {
+  int32_t w[MODEL_ELEMENTS + 1];
+  int32_t x[MODEL_ELEMENTS + 1];
+  int32_t sum;
+  uint8_t i, j, sweep;
+  uint8_t shift = 0;
+
+  if ((_dead_time == 0) || (_samples < MODEL_HORIZON)) return false;
+
+  // Pull the fit towards the previous model, so an element the run barely
+  // used keeps its old gain, rather than the fit being singular.
+  for (i = 0; i <= MODEL_ELEMENTS; i++) {
+    w[i] = MODEL_PRIOR_WEIGHT * ((_a[i][i] / _samples) + 1);
+    while (((_a[i][i] + w[i]) >> shift) >= (1L << MODEL_FIT_BITS)) shift++;
+  }
+
+  // Scale the sums so the solve stays in 32 bits.  The largest diagonal is below
+  // 2^MODEL_FIT_BITS, and the others are no larger, so each product below fits.
+  // Start from the previous model, 1/4096ths of 0.01 Degree per second, per 1/8th % or half Degree.
+  for (i = 0; i < MODEL_ELEMENTS; i++) x[i] = (((int32_t)_model.gain[i]) * 128) / 25;
+  x[MODEL_ELEMENTS] = (((int32_t)_model.loss) * 25) / 8;
+  for (i = 0; i <= MODEL_ELEMENTS; i++) {
+    x[i] = constrain(x[i], 0, MODEL_FIT_MAX);
+    for (j = 0; j <= MODEL_ELEMENTS; j++) _a[i][j] >>= shift;
+    w[i] >>= shift;
+    _a[i][i] = max(_a[i][i] + w[i], 1L);
+    _b[i] = constrain(_b[i] >> shift, -(1L << (29 - MODEL_FIT_SHIFT)), 1L << (29 - MODEL_FIT_SHIFT));
+    _b[i] = (_b[i] << MODEL_FIT_SHIFT) + (w[i] * x[i]);
+  }
+
+  // Gauss-Seidel on the normal equations, which always converges, as they are positive definite.
+  // Gains and loss can't be negative, so neither can the fit.
+  for (sweep = 0; sweep < MODEL_FIT_SWEEPS; sweep++) {
+    for (i = 0; i <= MODEL_ELEMENTS; i++) {
+      sum = _b[i];
+      for (j = 0; j <= MODEL_ELEMENTS; j++) {
+        if (j != i) sum -= _a[i][j] * x[j];
+      }
+      x[i] = constrain(sum / _a[i][i], 0, MODEL_FIT_MAX);
+    }
+  }
+  // The sums are used up, start them again.
+  memset(_a, 0, sizeof(_a));
+  memset(_b, 0, sizeof(_b));
+  _samples = 0;
+
+  for (i = 0; i < MODEL_ELEMENTS; i++) {
+    _model.gain[i] = (x[i] * 25) / 128;
+  }
+  _model.loss = (x[MODEL_ELEMENTS] * 8) / 25;
+  _model.dead_time = _dead_time;
+  if (_tau != 0) _model.tau = (_model.tau + _tau + 1) / 2; // One fall is noisy, so average it in
+  _valid = true;
+
+  model = _model;
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef __PID_H__
+#define __PID_H__
+
+// Fixed point PID controller, with feed forward.
+// Temperatures are in Quarter Degrees, and the rate in 0.01 Degrees per second,
+// as in TC_Sample_t.  The output is in percent.
+// Gains are in 1/256ths:
+//   kp = percent per Degree of error
+//   ki = percent per Degree of error, per second
+//   kd = percent per Degree per second the oven rises faster than the setpoint
+// The derivative is taken on the measured rate, less the rate the setpoint is
+// ramping at, not on the error.  So setpoint steps don't kick the output, and
+// the derivative doesn't hold back the oven while it follows a ramp.
+
+#include "Temperature.h"
+
+#define PID_MAX_DT_MS     (500)       // Longest time step integrated, so a late update can't wind up the integral
+#define PID_MAX_I_ERROR   QDEG(50)    // Largest error integrated, to limit windup on big errors
+
+// Oven control, shared by ReflowTrack and RunProgram.
+// The output is the power of a balance of element duties, 100% being the duties.
+#define PID_OVEN_KP       (4 * 256)   // 4% per Degree of error
+#define PID_OVEN_KI       (13)        // 0.05% per Degree second
+#define PID_OVEN_KD       (20 * 256)  // 20% per Degree per second
+#define PID_HOLD_ERROR    QDEG(10)    // Ramps wait while the oven is this far behind
+#define PID_AT_ERROR      QDEG(2)     // A ramp ends once the oven is this close
+#define PID_MAX_POWER     (250)       // Most power, percent of the balance
+
+class ControLeo2_PID {
+  public:
+    ControLeo2_PID(void) {
+      setGains(0, 0, 0);
+      setLimits(0, 100);
+      reset();
+    }
+
+    void setGains(uint16_t kp, uint16_t ki, uint16_t kd) {
+      _kp = kp;
+      _ki = ki;
+      _kd = kd;
+    }
+
+    // Output range, in percent.
+    void setLimits(int16_t min, int16_t max) {
+      _min = ((int32_t)min) << 8;
+      _max = ((int32_t)max) << 8;
+    }
+
+    // Output range for driving a balance of element duties, so the largest
+    // element can reach 100%, but no more than PID_MAX_POWER.
+    void setBalanceLimits(const uint8_t balance[3]) {
+      uint8_t largest = max(max(balance[0], balance[1]), balance[2]);
+
+      setLimits(0, (largest == 0) ? 0 : min(10000 / largest, PID_MAX_POWER));
+    }
+
+    // Clear the integral.
+    void reset(void) {
+      _i = 0;
+    }
+
+    // Calculate the output (percent).
+    // setpoint and measured in Quarter Degrees, rate in 0.01 Degrees per second
+    // (the measured rate less the setpoint's ramp rate), feedforward in percent,
+    // dt_ms is the time since the last update.
+    int16_t update(qdeg_t setpoint, qdeg_t measured, int16_t rate, int16_t feedforward, uint16_t dt_ms) {
+      qdeg_t  error = qdegSub(setpoint, measured);
+      qdeg_t  i_error;
+      int32_t i;
+      int32_t output;
+
+      if (dt_ms > PID_MAX_DT_MS) dt_ms = PID_MAX_DT_MS;
+      i_error = constrain(error, -PID_MAX_I_ERROR, PID_MAX_I_ERROR);
+
+      // All terms are percent * 256.
+      output = (((int32_t)feedforward) << 8)
+             + ((((int32_t)_kp) * error) >> 2)
+             - ((((int32_t)_kd) * rate) / 100);
+
+      i = _i + (((((int32_t)_ki) * i_error) >> 2) * dt_ms) / 1000;
+
+      // Only integrate if it doesn't drive the output further past a limit.
+      if (!(((output + i) > _max) && (i > _i)) &&
+          !(((output + i) < _min) && (i < _i))) {
+        _i = i;
+      }
+      output += _i;
+
+      if (output > _max) output = _max;
+      if (output < _min) output = _min;
+
+      return (output + 128) >> 8;
+    }
+
+    // Integral term (percent * 256).
+    int32_t integral(void) { return _i; }
+
+  private:
+    uint16_t _kp;
+    uint16_t _ki;
+    uint16_t _kd;
+    int32_t  _min;  // Output limits, percent * 256
+    int32_t  _max;
+    int32_t  _i;    // Integral term, percent * 256
+};
+
+#endif
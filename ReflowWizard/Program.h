@@ -0,0 +1,61 @@
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+// Segment Programs.
+// A Program is a list of 2 byte segments, run in order by RunProgram():
+//   byte 0 = (op << 4) | param, byte 1 = arg
+// Some segments take a 12 bit value, (param << 8) | arg.
+// A Mode of type PROGRAM holds its segments in SP_CODE onwards, otherwise the
+// built-in J-STD Program is run.  Running off the end, or a blank (0xFF)
+// segment, ends the Program like PROG_END.
+//
+// While ramping or holding, a PID controller drives the elements at a power of
+// the element balance set by PROG_ELEMENT, as ReflowTrack does with a phase's
+// duty cycles.  While waiting, the elements are off.
+
+enum PROG_OP {
+  PROG_END,         // Finished.  Everything off, door retracted.
+  PROG_RAMP_TO,     // Ramp the setpoint to a temperature (12 bit, Degrees), at the ramp rate.
+                    //   Ends once the oven is there.
+  PROG_RAMP_RATE,   // Rate of following ramps (12 bit, 0.01 Degree per second), 0 = as fast as possible.
+  PROG_HOLD,        // Hold the setpoint for a time (12 bit, seconds).
+  PROG_WAIT,        // Elements off, until a condition (param = PROG_WAIT_*), arg = Degrees / 2.
+  PROG_DOOR,        // Open the door, arg percent from Armed (0) to Open (100).
+  PROG_FAN,         // Set a fan (param = PROG_FAN_*) to arg percent.
+  PROG_ELEMENT,     // Set an element's (param = PROG_ELEMENT_*) balance, its duty (arg percent) at 100% power.
+  PROG_ALERT,       // Play a tune (param = TUNE_*), and show a message (arg = PROG_MSG_*).
+};
+
+enum PROG_WAIT_CONDITION {
+  PROG_WAIT_BELOW,  // Temperature below arg * 2 Degrees
+  PROG_WAIT_ABOVE,  // Temperature above arg * 2 Degrees
+  PROG_WAIT_COOL,   // Temperature below SG_COOL_TEMPERATURE
+  PROG_WAIT_BUTTON, // Top button pressed
+};
+
+enum PROG_FAN_TYPE {
+  PROG_FAN_CONVECTION,
+  PROG_FAN_COOLING,
+};
+
+enum PROG_ELEMENT_TYPE {
+  PROG_ELEMENT_BOTTOM,
+  PROG_ELEMENT_BOOST,
+  PROG_ELEMENT_TOP,
+};
+
+enum PROG_MESSAGE {
+  PROG_MSG_NONE,
+  PROG_MSG_OPEN_DOOR,     // "Cool - open door"
+  PROG_MSG_REMOVE_BOARDS, // "Okay to remove  "
+  PROG_MSG_PRESS_TOP,     // "Press top button"
+};
+
+// Segment encoding.
+#define PROG_SEG(OP, PARAM, ARG)  (uint8_t)(((OP) << 4) | ((PARAM) & 0x0F)), (uint8_t)(ARG)
+#define PROG_SEG12(OP, VALUE)     PROG_SEG(OP, (VALUE) >> 8, (VALUE) & 0xFF)
+
+#define PROG_SEGMENT_SIZE         (2)
+#define PROG_MAX_VALUE            (0x0FFF)
+
+#endif
@@ -0,0 +1,291 @@
+// Segment Program interpreter, see Program.h
+// Called from the main loop.  Each call does the work of the current segment
+// only, and at most one segment is started per call, so a call is O(1)
+// whatever the Program.
+
+#include "PID.h"
+#include "Program.h"
+#include "Temperature.h"
+
+#define PROGRAM_SP_SCALE    (2500L)    // Setpoint is held in 1/10000ths Degree, so slow ramps don't lose fractions
+
+// The J-STD-020 curve, as ReflowTrack and the default Reflow Mode run it.
+const PROGMEM uint8_t ProgramJSTD[] = {
+  PROG_SEG  (PROG_FAN,       PROG_FAN_CONVECTION, 100),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOTTOM,  80),   // Presoak
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOOST,   30),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_TOP,     50),
+  PROG_SEG12(PROG_RAMP_RATE, 147),                        // 25C to 150C in 85 seconds
+  PROG_SEG12(PROG_RAMP_TO,   150),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOTTOM,  70),   // Soak
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOOST,   35),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_TOP,     40),
+  PROG_SEG12(PROG_RAMP_RATE, 45),                         // 150C to 200C in 110 seconds
+  PROG_SEG12(PROG_RAMP_TO,   200),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOTTOM,  80),   // Reflow
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOOST,   50),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_TOP,     50),
+  PROG_SEG12(PROG_RAMP_RATE, 50),                         // 200C to 240C in 80 seconds
+  PROG_SEG12(PROG_RAMP_TO,   240),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOTTOM,   0),   // Waiting, let the heat soak in
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_BOOST,    0),
+  PROG_SEG  (PROG_ELEMENT,   PROG_ELEMENT_TOP,      0),
+  PROG_SEG12(PROG_HOLD,      40),
+  PROG_SEG  (PROG_ALERT,     TUNE_REFLOW_DONE,    PROG_MSG_OPEN_DOOR),
+  PROG_SEG  (PROG_DOOR,      0,                   100),   // Cooling, boards stay in
+  PROG_SEG  (PROG_FAN,       PROG_FAN_COOLING,    100),
+  PROG_SEG  (PROG_WAIT,      PROG_WAIT_BELOW,     100 / 2),
+  PROG_SEG  (PROG_ALERT,     TUNE_REMOVE_BOARDS,  PROG_MSG_REMOVE_BOARDS),
+  PROG_SEG  (PROG_WAIT,      PROG_WAIT_COOL,        0),
+  PROG_SEG  (PROG_END,       0,                     0),
+};
+
+ControLeo2_PID programPID;
+
+// Segment byte at pc, from the Mode, or the built-in Program.
+// Past the end is PROG_END.
+uint8_t programByte(bool builtin, uint8_t pc) {
+  if (builtin) {
+    return (pc < sizeof(ProgramJSTD)) ? pgm_read_byte(&ProgramJSTD[pc]) : (uint8_t)PROG_END;
+  }
+  return (pc < (SP_CHECK_VALUE - SP_CODE)) ? (uint8_t)ModeSettings[SP_CODE + pc] : (uint8_t)PROG_END;
+}
+
+// Drive the elements at power percent of the balance, and return the duties driven.
+// Also used by ReflowTrack.
+void setElementPower(const uint8_t balance[3], uint16_t power, uint8_t duty[3]) {
+  for (uint8_t i = 0; i < 3; i++) {
+    duty[i] = min((balance[i] * power) / 100, 100);
+  }
+  relays.SetRelay(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, duty[0]);
+  relays.SetRelay(ControLeo2_Relays::RELAY_BOOST_ELEMENT,  duty[1]);
+  relays.SetRelay(ControLeo2_Relays::RELAY_TOP_ELEMENT,    duty[2]);
+}
+
+// A setpoint held in PROGRAM_SP_SCALE units, in Quarter Degrees.
+qdeg_t programQdeg(int32_t setpoint) {
+  return qdegSaturate(setpoint / PROGRAM_SP_SCALE);
+}
+
+void programMessage(uint8_t message) {
+  switch (message) {
+    case PROG_MSG_OPEN_DOOR     : lcd.PrintStr(0, 0, FM("Cool - open door")); break;
+    case PROG_MSG_REMOVE_BOARDS : lcd.PrintStr(0, 0, FM("Okay to remove  ")); break;
+    case PROG_MSG_PRESS_TOP     : lcd.PrintStr(0, 0, FM("Press top button")); break;
+  }
+}
+
+// Return false to exit this mode
+bool RunProgram() {
+  static bool     running = false;
+  static bool     builtin;          // Running ProgramJSTD, not the Mode's segments
+  static uint8_t  pc;               // Byte of the current segment
+  static bool     started;          // Current segment has started
+  static bool     heating;          // PID is driving the elements
+  static int32_t  setpoint;         // PROGRAM_SP_SCALE per Quarter Degree
+  static int32_t  target;           // End of the current ramp, same units
+  static uint16_t rate;             // Ramp rate, 0.01 Degree per second
+  static uint8_t  balance[3];       // Element duties at 100% power
+  static uint32_t segmentTime;      // millis() the current segment started
+  static uint32_t lastSampleTime;
+  static uint8_t  lastSequence;
+  static uint8_t  power;
+  static bool     stopped = false;  // Ended, showing the last message
+
+  uint32_t currentTime = millis();
+  uint8_t  op, param, arg;
+  uint8_t  duty[3];
+  uint16_t value;
+  uint16_t dt;
+  int16_t  slope;
+  uint8_t  key = buttons.GetKeypress();
+  bool     next = false;
+  int16_t  door;
+
+  const TC_Sample_t& sample = temps.getSample();
+
+  if (!running) {
+    if ((THERMOCOUPLE_FAULT(sample.fault)) ||
+        (sample.temperature > qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE)))) {
+      lcd.PrintStr(0, 0, FM("Oven not cool   "));
+      Serial.println(FM("Oven too hot to start program.  Please wait ..."));
+      return false;
+    }
+
+    ReadModeConfig(CurrentMode);
+    builtin = (readModeSetting(SR_TYPE) != PROGRAM);
+
+    temps.setFilterMode(FILTER_BOXCAR);
+    programPID.setGains(PID_OVEN_KP, PID_OVEN_KI, PID_OVEN_KD);
+    programPID.reset();
+
+    running        = true;
+    pc             = 0;
+    started        = false;
+    heating        = false;
+    rate           = 0;
+    power          = 0;
+    memset(balance, 0, sizeof(balance));
+    programPID.setBalanceLimits(balance);
+    lastSampleTime = sample.time;
+    lastSequence   = sample.sequence;
+    Serial.println(FM("Segment, Setpoint, Temperature, Power"));
+  }
+
+  op    = programByte(builtin, pc) >> 4;
+  param = programByte(builtin, pc) & 0x0F;
+  arg   = programByte(builtin, pc + 1);
+  value = (((uint16_t)param) << 8) | arg;
+
+  // Abort on a thermocouple fault, over temperature, or a long press of the bottom button.
+  if (stopped) {
+    op = PROG_END;
+  } else if (THERMOCOUPLE_FAULT(sample.fault)) {
+    lcd.PrintStr(0, 0, FM("Thermocouple err"));
+    Serial.print(FM("Program aborted, thermocouple error: "));
+    Serial.println(ThermocoupleFaultStr(sample.fault));
+    op = PROG_END;
+  } else if (sample.temperature >= qdegFromDegrees(readGlobalSetting(SG_OVER_TEMPERATURE))) {
+    lcd.PrintStr(0, 0, FM("Over temperature"));
+    Serial.println(FM("Program aborted, over temperature"));
+    op = PROG_END;
+  } else if (key == BUTTON_BOT_LONG_HOLD) {
+    lcd.PrintStr(0, 0, FM("Aborting program"));
+    Serial.println(FM("Button pressed.  Aborting program ..."));
+    op = PROG_END;
+  }
+
+  switch (op) {
+    case PROG_RAMP_TO:
+    case PROG_HOLD:
+      if (!started) {
+        started        = true;
+        segmentTime    = currentTime;
+        lastSampleTime = sample.time;
+        lastSequence   = sample.sequence;
+        if (!heating) {
+          // Ramps start from where the oven is.
+          heating  = true;
+          setpoint = sample.temperature * PROGRAM_SP_SCALE;
+          programPID.reset();
+        }
+        if (op == PROG_RAMP_TO) {
+          target = ((int32_t)qdegFromDegrees(value)) * PROGRAM_SP_SCALE;
+          if (rate == 0) setpoint = target;
+        }
+      }
+
+      // Only act on new temperature samples.
+      if (sample.sequence == lastSequence) break;
+      lastSequence = sample.sequence;
+      dt = sample.time - lastSampleTime;
+      lastSampleTime = sample.time;
+
+      if (op == PROG_RAMP_TO) {
+        // Hold the ramp while the oven is well behind it, so its shape is kept.
+        if (qdegAbs(qdegSub(programQdeg(setpoint), sample.temperature)) < PID_HOLD_ERROR) {
+          if (setpoint < target) {
+            setpoint = min(setpoint + (((int32_t)rate * dt) / 10), target);
+          } else {
+            setpoint = max(setpoint - (((int32_t)rate * dt) / 10), target);
+          }
+        }
+        next = (setpoint == target) &&
+               (qdegAbs(qdegSub(programQdeg(target), sample.temperature)) <= PID_AT_ERROR);
+      } else {
+        next = (currentTime - segmentTime) >= (value * 1000UL);
+      }
+
+      // The derivative acts on how much faster than the ramp the oven is rising.
+      slope = 0;
+      if ((op == PROG_RAMP_TO) && (setpoint != target)) {
+        slope = (setpoint < target) ? (int16_t)rate : -(int16_t)rate;
+      }
+      power = programPID.update(programQdeg(setpoint), sample.temperature, sample.rate - slope, 100, dt);
+      setElementPower(balance, power, duty);
+      break;
+
+    case PROG_RAMP_RATE:
+      rate = value;
+      next = true;
+      break;
+
+    case PROG_WAIT:
+      if (heating) {
+        heating = false;
+        power   = 0;
+        setElementPower(balance, 0, duty);
+      }
+      switch (param) {
+        case PROG_WAIT_BELOW  : next = (sample.temperature < qdegFromDegrees(arg * 2)); break;
+        case PROG_WAIT_ABOVE  : next = (sample.temperature > qdegFromDegrees(arg * 2)); break;
+        case PROG_WAIT_COOL   : next = (sample.temperature < qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE))); break;
+        case PROG_WAIT_BUTTON : next = ((key == BUTTON_TOP_PRESS) || (key == BUTTON_TOP_RELEASE)); break;
+        default               : next = true; break;
+      }
+      break;
+
+    case PROG_DOOR:
+      // arg percent of the way from Armed to Open.
+      door = readGlobalSetting(SG_SERVO_ARMED_DEG);
+      door += ((int16_t)(readGlobalSetting(SG_SERVO_OPEN_DEG) - door) * (int16_t)min(arg, 100)) / 100;
+      setServoPosition(door, readGlobalSetting(SG_SERVO_OPEN_TIME) * 100);
+      next = true;
+      break;
+
+    case PROG_FAN:
+      relays.SetRelay((param == PROG_FAN_COOLING) ? ControLeo2_Relays::RELAY_COOLING_FAN
+                                                  : ControLeo2_Relays::RELAY_CONVECTION_FAN, arg);
+      next = true;
+      break;
+
+    case PROG_ELEMENT:
+      if (param <= PROG_ELEMENT_TOP) {
+        balance[param] = min(arg, 100);
+        programPID.setBalanceLimits(balance);
+      }
+      next = true;
+      break;
+
+    case PROG_ALERT:
+      programMessage(arg);
+      playTones(param);
+      next = true;
+      break;
+
+    default: // PROG_END, or not a segment
+      if (!stopped) {
+        stopped = true;
+        Serial.println(FM("Program is done!"));
+        // Turn all elements and fans off, and close the door.
+        relays.SetRelay(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_BOOST_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_TOP_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_CONVECTION_FAN, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_COOLING_FAN, 0);
+        setServoPosition(readGlobalSetting(SG_SERVO_RETRACT_DEG), readGlobalSetting(SG_SERVO_OPEN_TIME) * 100);
+        // Allow the user to read the last message
+        holdMessage(3000);
+      }
+      if (messageShowing()) break;
+      // Start next time from the first segment
+      stopped = false;
+      running = false;
+      return false;
+  }
+
+  if (next) {
+    pc += PROG_SEGMENT_SIZE;
+    started = false;
+
+    Serial.print(pc / PROG_SEGMENT_SIZE);
+    Serial.print(FM(", "));
+    Serial.print(qdegToDegrees(programQdeg(setpoint)));
+    Serial.print(FM(", "));
+    Serial.print(qdegToDegrees(sample.temperature));
+    Serial.print(FM(", "));
+    Serial.println(power);
+  }
+
+  return true;
+}
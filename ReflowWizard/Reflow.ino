@@ -1,6 +1,16 @@
 // Reflow logic
 // Called from the main loop 20 times per second
 // This where the reflow logic is controlled
+// The profile is the Current Mode's settings (ModeSettings), and the elements are
+// driven through the virtual relays, so the relays do the PWM.
+// The time above liquidus and the peak are tracked, and cut the heat, or start the
+// cooling, early when needed to stay inside the profile.
+// The run is measured against the profile trajectory ReflowTrack follows, and its
+// summary saved and shown at the end.
+
+#include "Liquidus.h"
+#include "Metrics.h"
+#include "Temperature.h"
 
 
 // Buffer used for Serial.print
@@ -8,38 +18,52 @@ char debugBuffer[100];
 
 #define MILLIS_TO_SECONDS    ((long) 1000)
 
-// The data for each of pre-soak, soak and reflow phases
-struct phaseData {
-  int elementDutyCycle[4];    // Duty cycle for each output
-  int endTemperature;         // The temperature at which to move to the next reflow phase
-  int phaseMinDuration;       // The minimum number of seconds that this phase should run for
-  int phaseMaxDuration;       // The maximum number of seconds that this phase should run for
-};
+// Most any adjustment, or catching up, will drive each element
+#define REFLOW_MAX_BOTTOM    (100)  // All heat from the bottom element will hit the aluminum tray
+#define REFLOW_MAX_BOOST     (60)   // The boost element is just a mold heater, and probably not optimally located
+#define REFLOW_MAX_TOP       (80)   // With IR radiation and insulation just above it, there is never a good reason to go higher
+
+ControLeo2_Liquidus   reflowLiquidus;
+ControLeo2_RunMetrics reflowMetrics;
+
+// Setting of a reflow phase (PHASE_PRESOAK - PHASE_REFLOW)
+#define reflowSetting(phase, entry) readModeSetting(SR_PHASE((phase) - PHASE_PRESOAK, entry))
+
+// Drive the elements at the given duty cycles.
+void reflowSetElements(uint8_t bottom, uint8_t boost, uint8_t top) {
+  relays.SetRelay(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, bottom);
+  relays.SetRelay(ControLeo2_Relays::RELAY_BOOST_ELEMENT,  boost);
+  relays.SetRelay(ControLeo2_Relays::RELAY_TOP_ELEMENT,    top);
+}
 
 
 // Return false to exit this mode
 boolean Reflow() {
   static int reflowPhase = PHASE_INIT;
-  static int outputType[4];
-  static int maxTemperature;
   static boolean learningMode;
-  static phaseData phase[PHASE_REFLOW+1];
+  static boolean fullPower;              // Not learning, and too slow.  Elements at their limits for the rest of the phase.
+  static int phaseMaxDuration;           // Maximum seconds of this phase, can be extended when learning
   static unsigned long phaseStartTime, reflowStartTime;
-  static int elementDutyCounter[4];
   static int counter = 0;
   static boolean firstTimeInPhase = true;
+  static boolean stopped = false;        // Everything is off, waiting for the last message to be read
+  static boolean completed;              // The reflow ran to the end
+  static qdeg_t phaseStartTemp;          // Temperature the phase's trajectory starts from
   
-  double currentTemperature;
+  qdeg_t currentTemperature;
   unsigned long currentTime = millis();
-  int i, j;
-  int elementDutyStart = 0;
+  int i;
+  boolean cutHeat;
+  Oven_Model_t model;
+  Run_Summary_t summary;
   
   // Read the temperature
-  currentTemperature = getCurrentTemperature();
-  if (THERMOCOUPLE_FAULT(currentTemperature)) {
+  const TC_Sample_t& sample = temps.getSample();
+  currentTemperature = sample.temperature;
+  if (THERMOCOUPLE_FAULT(sample.fault) && (reflowPhase != PHASE_ABORT_REFLOW)) {
     lcdPrintLine_P(0, PSTR("Thermocouple err"));
     Serial.print(F("Thermocouple Error: "));
-    switch ((int) currentTemperature) {
+    switch (sample.fault) {
       case FAULT_OPEN:
         lcdPrintLine_P(1, PSTR("Fault open"));
         Serial.println(F("Fault open"));
@@ -50,6 +74,15 @@ boolean Reflow() {
         break;
       case FAULT_SHORT_VCC:
         lcdPrintLine_P(1, PSTR("Short to VCC"));
+        Serial.println(F("Short to VCC"));
+        break;
+      case FAULT_OVERTEMP:
+        lcdPrintLine_P(1, PSTR("Over temperature"));
+        Serial.println(F("Over temperature"));
+        break;
+      default:
+        lcdPrintLine_P(1, PSTR("Unknown fault"));
+        Serial.println(F("Unknown fault"));
         break;
     }
     
@@ -59,20 +92,34 @@ boolean Reflow() {
   }
   
   // Abort the reflow if a button is pressed
-  if (buttons.GetKeypress() == BUTTON_BOT_LONG_HOLD) {
+  if ((buttons.GetKeypress() == BUTTON_BOT_LONG_HOLD) && (reflowPhase != PHASE_ABORT_REFLOW)) {
     reflowPhase = PHASE_ABORT_REFLOW;
     lcdPrintLine_P(0, PSTR("Aborting reflow"));
     lcdPrintLine_P(1, PSTR("Button pressed"));
     Serial.println(F("Button pressed.  Aborting reflow ..."));
   }
+
+  // Track the time above liquidus, and the peak
+  reflowLiquidus.update(currentTime, currentTemperature, sample.rate);
+
+  // Measure the run against the profile trajectory
+  if ((reflowPhase >= PHASE_PRESOAK) && (reflowPhase <= PHASE_REFLOW))
+    reflowMetrics.update(currentTime, reflowPhase - PHASE_PRESOAK,
+                         profileSetpoint(reflowPhase - PHASE_PRESOAK, phaseStartTemp, currentTime - phaseStartTime),
+                         currentTemperature, sample.rate);
+  else if (reflowPhase == PHASE_WAITING)
+    reflowMetrics.update(currentTime, PHASE_REFLOW - PHASE_PRESOAK, qdegFromDegrees(readModeSetting(SR_REFLOW_MAXTEMP)),
+                         currentTemperature, sample.rate);
+  else
+    reflowMetrics.update(currentTime, METRICS_NO_TARGET, 0, currentTemperature, sample.rate);
   
   switch (reflowPhase) {
     case PHASE_INIT: // User has requested to start a reflow
       
       // Make sure the oven is cool.  This makes for more predictable/reliable reflows and
       // gives the SSR's time to cool down a bit.
-      if (currentTemperature > 50.0) {
-        lcdPrintLine_P(0, PSTR("Temp > 50\1C"));
+      if (currentTemperature > qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE))) {
+        lcdPrintLine_P(0, PSTR("Oven not cool"));
         lcdPrintLine_P(1, PSTR("Please wait..."));
         Serial.println(F("Oven too hot to start reflow.  Please wait ..."));
         
@@ -81,16 +128,15 @@ boolean Reflow() {
         break;
       }
     
-      // Get the types for the outputs (elements, fan or unused)
-      for (i=0; i<4; i++)
-        outputType[i] = getSetting(SETTING_D4_TYPE + i);
-      // Get the maximum temperature
-      maxTemperature = getSetting(SETTING_MAX_TEMPERATURE);
+      // Reflow ramps need a short, fixed lag on the temperature readings
+      temps.setFilterMode(FILTER_BOXCAR);
 
       // Don't allow reflow if the outputs are not configured
-      for (i=0; i<4; i++)
-        if (isHeatingElement(outputType[i]))
+      for (i=0; i<4; i++) {
+        uint8_t type = readGlobalSetting((SG_Entries_t)(SG_D4_TYPE + i));
+        if ((type >= ControLeo2_Relays::RELAY_BOTTOM_ELEMENT) && (type <= ControLeo2_Relays::RELAY_TOP_ELEMENT))
           break;
+      }
       if (i == 4) {
         lcdPrintLine_P(0, PSTR("Please configure"));
         lcdPrintLine_P(1, PSTR(" outputs first! "));
@@ -101,131 +147,67 @@ boolean Reflow() {
         break;
       }
       
-      // If the settings have changed then set up learning mode
-      if (getSetting(SETTING_SETTINGS_CHANGED) == true) {
-        setSetting(SETTING_SETTINGS_CHANGED, false);
-        // Tell the user that learning mode is being enabled
-        lcdPrintLine_P(0, PSTR("Settings changed"));
-        lcdPrintLine_P(1, PSTR("Initializing..."));
-        Serial.println(F("Settings changed by user.  Reinitializing element duty cycles and enabling learning mode ..."));
-        
-        // Turn learning mode on
-        setSetting(SETTING_LEARNING_MODE, true);
-        // Set the starting duty cycle for each output.  These settings are conservative
-        // because it is better to increase them each cycle rather than risk damage to
-        // the PCB or components
-        // Presoak = Rapid rise in temperature
-        //           Lots of heat from the bottom, some from the top
-        // Soak    = Stabilize temperature of PCB and components
-        //           Heat from the bottom, not much from the top
-        // Reflow  = Heat the solder and pads rapidly
-        //           Lots of heat from all directions
-        for (i=0; i<4; i++) {
-          switch (outputType[i]) {
-            case TYPE_UNUSED:
-            case TYPE_COOLING_FAN:
-              setSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + i, 0);
-              setSetting(SETTING_SOAK_D4_DUTY_CYCLE + i, 0);
-              setSetting(SETTING_REFLOW_D4_DUTY_CYCLE + i, 0);
-              break;
-            case TYPE_TOP_ELEMENT:
-              setSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + i, 50);
-              setSetting(SETTING_SOAK_D4_DUTY_CYCLE + i, 40);
-              setSetting(SETTING_REFLOW_D4_DUTY_CYCLE + i, 50);
-              break;
-            case TYPE_BOTTOM_ELEMENT:
-              setSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + i, 80);
-              setSetting(SETTING_SOAK_D4_DUTY_CYCLE + i, 70);
-              setSetting(SETTING_REFLOW_D4_DUTY_CYCLE + i, 80);
-              break;
-            case TYPE_BOOST_ELEMENT:
-              setSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + i, 30);
-              setSetting(SETTING_SOAK_D4_DUTY_CYCLE + i, 35);
-              setSetting(SETTING_REFLOW_D4_DUTY_CYCLE + i, 50);
-              break;
-            case TYPE_CONVECTION_FAN:
-              setSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + i, 100);
-              setSetting(SETTING_SOAK_D4_DUTY_CYCLE + i, 100);
-              setSetting(SETTING_REFLOW_D4_DUTY_CYCLE + i, 100);
-              break;
-          }
-        }
-        // Wait a bit to allow the user to read the message
-        delay(3000);
-      } // end of settings changed
-      
-      // Read all the settings
-      learningMode = getSetting(SETTING_LEARNING_MODE);
-      for (i=PHASE_PRESOAK; i<=PHASE_REFLOW; i++) {
-        for (j=0; j<4; j++)
-          phase[i].elementDutyCycle[j] = getSetting(SETTING_PRESOAK_D4_DUTY_CYCLE + ((i-PHASE_PRESOAK) *4) + j);
-        // Time to peak temperature should be between 3.5 and 5.5 minutes.
-        // While J-STD-20 gives exact phase temperatures, the reading depends very much on the thermocouple used
-        // and its location.  Varying the phase temperatures as the max temperature changes allows for thermocouple
-        // variation.
-        // Keep in mind that there is a 2C error in the MAX31855, and typically a 3C error in the thermocouple.
-        switch(i) {
-          case PHASE_PRESOAK:
-            phase[i].endTemperature = maxTemperature * 3 / 5; // J-STD-20 gives 150C
-            phase[i].phaseMinDuration = 60;
-            phase[i].phaseMaxDuration = 110;
-            break;
-          case PHASE_SOAK:
-            phase[i].endTemperature = maxTemperature * 4 / 5; // J-STD-20 gives 200C
-            phase[i].phaseMinDuration = 80;
-            phase[i].phaseMaxDuration = 140;
-            break;
-          case PHASE_REFLOW:
-            phase[i].endTemperature = maxTemperature;
-            phase[i].phaseMinDuration = 60;
-            phase[i].phaseMaxDuration = 100;
-            break;
-        }
-      }
+      // The profile, and its duty cycles, are the Current Mode's.  A Mode starts with the
+      // conservative default duty cycles, and learning needed, and adjusts them as it learns.
+      ReadModeConfig(CurrentMode);
+      learningMode = (readModeSetting(SR_TYPE) == REFLOW_LEARN);
+
       // Let the user know if learning mode is on
       if (learningMode) {
-        lcdPrintLine_P(0, PSTR("Learning Mode"));
-        lcdPrintLine_P(1, PSTR("is enabled"));
+        showMessage(FM("Learning Mode   "), FM("is enabled      "), 3000);
         Serial.println(F("Learning mode is enabled.  Duty cycles may be adjusted automatically if necessary"));
-        delay(3000);
       }
       
       // Move to the next phase
       reflowPhase = PHASE_PRESOAK;
-      lcdPrintLine(0, phaseDescription[reflowPhase]);
-      lcdPrintLine_P(1, PSTR(""));
-      
-      // Display information about this phase
-      serialDisplayPhaseData(reflowPhase, &phase[reflowPhase], outputType);
-
-      // Stagger the element start cycle to avoid abrupt changes in current draw
-      for (i=0; i< 4; i++) {
-        elementDutyCounter[i] = elementDutyStart;
-        // Turn the next element on (elementDutyCounter[i+1] == 0) when this element turns off (elementDutyCounter[i] == phase[reflowPhase].elementDutyCycle[i])
-        // For example, assume two element both at 20% duty cycle.  
-        //   The counter for the first starts at 0
-        //   The counter for the second should start at 80, because by the time counter 1 = 20 (1 turned off) counter 2 = 0 (counter 2 turned on)
-        elementDutyStart = (100 + elementDutyStart - phase[reflowPhase].elementDutyCycle[i]) % 100;
-      }
-      
-      // Start the reflow and phase timers
-      reflowStartTime = millis();
-      phaseStartTime = reflowStartTime;
+      firstTimeInPhase = true;
       break;
       
     case PHASE_PRESOAK:
     case PHASE_SOAK:
     case PHASE_REFLOW:
+      if (firstTimeInPhase) {
+        // Don't start the phase until any message has been read, the elements stay as they are.
+        if (messageShowing())
+          break;
+        firstTimeInPhase = false;
+        fullPower = false;
+        phaseMaxDuration = reflowSetting(reflowPhase, MAXTIME);
+        lcdPrintLine(0, phaseDescription[reflowPhase]);
+        if (reflowPhase == PHASE_PRESOAK) {
+          lcdPrintLine_P(1, PSTR(""));
+          // Start the reflow and phase timers
+          reflowStartTime = currentTime;
+          phaseStartTime = reflowStartTime;
+          reflowLiquidus.begin(currentTime, qdegFromDegrees(readModeSetting(SR_LIQUIDUS_TEMP)), qdegFromDegrees(readModeSetting(SR_REFLOW_MAXTEMP)),
+                               readModeSetting(SR_LIQUIDUS_MAXTIME), ReadModeModel(CurrentMode, model) ? &model : NULL);
+          reflowMetrics.begin(currentTime, qdegFromDegrees(readModeSetting(SR_PRESOAK_MAXTEMP)), qdegFromDegrees(readModeSetting(SR_SOAK_MAXTEMP)));
+          phaseStartTemp = currentTemperature;
+          completed = false;
+        }
+        relays.SetRelay(ControLeo2_Relays::RELAY_CONVECTION_FAN, reflowSetting(reflowPhase, CONVFAN_DUTY_CYCLE));
+        // Display information about this phase
+        serialDisplayPhaseData(reflowPhase);
+      }
+
+      // Would the oven coast past the peak, or stay above liquidus too long, if the heat isn't cut now?
+      cutHeat = (reflowPhase == PHASE_REFLOW) && reflowLiquidus.cutHeat();
+      if (cutHeat && (currentTemperature < qdegFromDegrees(reflowSetting(reflowPhase, MAXTEMP)))) {
+        Serial.print(F("Cutting the heat early.  Predicted peak is "));
+        printQdeg(reflowLiquidus.predictPeak());
+        Serial.println();
+      }
+
       // Has the ending temperature for this phase been reached?
-      if (currentTemperature >= phase[reflowPhase].endTemperature) {
+      if ((currentTemperature >= qdegFromDegrees(reflowSetting(reflowPhase, MAXTEMP))) || cutHeat) {
         // Was enough time spent in this phase?
-        if (currentTime - phaseStartTime < (unsigned long) (phase[reflowPhase].phaseMinDuration * MILLIS_TO_SECONDS)) {
+        if (currentTime - phaseStartTime < (unsigned long) (reflowSetting(reflowPhase, MINTIME) * MILLIS_TO_SECONDS)) {
           sprintf(debugBuffer, "Warning: Oven heated up too quickly! Phase took %ld seconds.", (currentTime - phaseStartTime) / MILLIS_TO_SECONDS);
           Serial.println(debugBuffer);
           // Too little time was spent in this phase
           if (learningMode) {
             // Were the settings close to being right for this phase?  Within 8 seconds?
-            if (phase[reflowPhase].phaseMinDuration - ((currentTime - phaseStartTime) / 1000) < 8) {
+            if (reflowSetting(reflowPhase, MINTIME) - ((currentTime - phaseStartTime) / 1000) < 8) {
               // Reduce the duty cycle for the elements for this phase, but continue with this run
               adjustPhaseDutyCycle(reflowPhase, -5);
               displayAdjustmentsMadeContinue(true);
@@ -252,42 +234,31 @@ boolean Reflow() {
           }
         }
         // The temperature is high enough to move to the next phase
+        phaseStartTemp = qdegFromDegrees(reflowSetting(reflowPhase, MAXTEMP));
         reflowPhase++;
         firstTimeInPhase = true;
-        lcdPrintLine(0, phaseDescription[reflowPhase]);
         phaseStartTime = millis();
-        // Stagger the element start cycle to avoid abrupt changes in current draw
-        for (i=0; i< 4; i++) {
-          elementDutyCounter[i] = elementDutyStart;
-          // Turn the next element on (elementDutyCounter[i+1] == 0) when this element turns off (elementDutyCounter[i] == phase[reflowPhase].elementDutyCycle[i])
-          // For example, assume two element both at 20% duty cycle.  
-          //   The counter for the first starts at 0
-          //   The counter for the second should start at 80, because by the time counter 1 = 20 (1 turned off) counter 2 = 0 (counter 2 turned on)
-          elementDutyStart = (100 + elementDutyStart - phase[reflowPhase].elementDutyCycle[i]) % 100;
-        }
-        // Display information about this phase
-        if (reflowPhase <= PHASE_REFLOW)
-          serialDisplayPhaseData(reflowPhase, &phase[reflowPhase], outputType);
         break;
       }
       
       // Has too much time been spent in this phase?
-      if (currentTime - phaseStartTime > (unsigned long) (phase[reflowPhase].phaseMaxDuration * MILLIS_TO_SECONDS)) {
+      if (currentTime - phaseStartTime > (unsigned long) (phaseMaxDuration * MILLIS_TO_SECONDS)) {
         Serial.print(F("Warning: Oven heated up too slowly! Current temperature is "));
-        Serial.println(currentTemperature);
+        printQdeg(currentTemperature);
+        Serial.println();
         // Still in learning mode?
         if (learningMode) {
-          double temperatureDelta = phase[reflowPhase].endTemperature - currentTemperature;
+          qdeg_t temperatureDelta = qdegSub(qdegFromDegrees(reflowSetting(reflowPhase, MAXTEMP)), currentTemperature);
                     
-          if (temperatureDelta <= 5) {
+          if (temperatureDelta <= QDEG(5)) {
             // Almost made it!  Make a small adjustment to the duty cycles.  Continue with the reflow
             adjustPhaseDutyCycle(reflowPhase, 4);
             displayAdjustmentsMadeContinue(true);
-            phase[reflowPhase].phaseMaxDuration += 20;
+            phaseMaxDuration += 20;
           }
           else {
             // A more dramatic temperature increase is needed for this phase
-            if (temperatureDelta < 10)
+            if (temperatureDelta < QDEG(10))
               adjustPhaseDutyCycle(reflowPhase, 9);
             else
               adjustPhaseDutyCycle(reflowPhase, 18);
@@ -308,55 +279,40 @@ boolean Reflow() {
           Serial.println(F("Duty cycles increased slightly for future runs"));
             
           // Turn all the elements on to get to temperature quickly
-          for (i=0; i<4; i++) {
-            switch(outputType[i]) {
-              case TYPE_BOTTOM_ELEMENT:
-                phase[reflowPhase].elementDutyCycle[i] = 100;
-                break;
-              case TYPE_TOP_ELEMENT:
-                phase[reflowPhase].elementDutyCycle[i] = 80;
-                break;
-              case TYPE_BOOST_ELEMENT:
-                phase[reflowPhase].elementDutyCycle[i] = 60;
-                break;
-                
-            }
-          }
+          fullPower = true;
             
           // Extend this phase by 10 seconds, or abort the reflow if it has taken too long
-          if (phase[reflowPhase].phaseMaxDuration < 200)
-            phase[reflowPhase].phaseMaxDuration += 10;
+          if (phaseMaxDuration < 200)
+            phaseMaxDuration += 10;
           else {
             lcdPrintPhaseMessage(reflowPhase, "Too slow");
             lcdPrintLine_P(1, PSTR("Aborting ..."));
             reflowPhase = PHASE_ABORT_REFLOW;
             Serial.println(F("Aborting reflow.  Oven cannot reach required temperature!"));
+            break;
           }
         }
       }
       
-      // Turn the output on or off based on its duty cycle
-      for (i=0; i< 4; i++) {
-        // Skip unused elements and cooling fan
-        if (outputType[i] == TYPE_UNUSED || outputType[i] == TYPE_COOLING_FAN)
-          continue;
+      // Set the elements to the duty cycles of this phase
+      if (reflowPhase == PHASE_PRESOAK && currentTemperature < qdegFromDegrees((reflowSetting(reflowPhase, MAXTEMP) * 3 / 5) - 10)) {
         // Turn all the elements on at the start of the presoak
-        if (reflowPhase == PHASE_PRESOAK && currentTemperature < (phase[reflowPhase].endTemperature * 3 / 5) - 10) {
-          digitalWrite(4 + i, HIGH);
-          continue;
-        }
-        // Turn the output on at 0, and off at the duty cycle value
-        if (elementDutyCounter[i] == 0)
-          digitalWrite(4 + i, HIGH);
-        if (elementDutyCounter[i] == phase[reflowPhase].elementDutyCycle[i])
-          digitalWrite(4 + i, LOW);
-        // Increment the duty counter
-        elementDutyCounter[i] = (elementDutyCounter[i] + 1) % 100;
+        reflowSetElements(100, 100, 100);
+      }
+      else if (fullPower) {
+        reflowSetElements(REFLOW_MAX_BOTTOM, REFLOW_MAX_BOOST, REFLOW_MAX_TOP);
+      }
+      else {
+        reflowSetElements(reflowSetting(reflowPhase, BOTTOM_DUTY_CYCLE),
+                          reflowSetting(reflowPhase, BOOST_DUTY_CYCLE),
+                          reflowSetting(reflowPhase, TOP_DUTY_CYCLE));
       }
       
       // Don't consider the reflow process started until the temperature passes 50 degrees
-      if (currentTemperature < 50.0)
+      if (currentTemperature < QDEG(50)) {
         phaseStartTime = currentTime;
+        phaseStartTemp = currentTemperature;
+      }
       
       // Update the displayed temperature roughly once per second
       if (counter++ % 20 == 0)
@@ -371,25 +327,27 @@ boolean Reflow() {
         lcdPrintLine_P(1, PSTR(" "));
         Serial.println(F("******* Phase: Waiting *******"));
         Serial.println(F("Turning all heating elements off ..."));
-        // Make sure all the elements are off (keep convection fans on)
-        for (int i=0; i<4; i++) {
-          if (outputType[i] != TYPE_CONVECTION_FAN)
-            digitalWrite(i+4, LOW);
-        }
+        // Make sure all the elements are off (keep convection fan on)
+        reflowSetElements(0, 0, 0);
         // If we made it here it means the reflow is within the defined parameters.  Turn off learning mode
-        setSetting(SETTING_LEARNING_MODE, false);
+        writeModeSetting(SR_TYPE, REFLOW);
       }
       // Update the displayed temperature roughly once per second
       if (counter++ % 20 == 0) {
         displayReflowTemperature(currentTime, reflowStartTime, phaseStartTime, currentTemperature);
         // Countdown to the end of this phase
-        lcd.PrintInt(13,0,2,40 - ((currentTime - phaseStartTime) / MILLIS_TO_SECONDS));
+        lcd.PrintInt(13,0,2,readModeSetting(SR_WAIT_MINTIME) - ((currentTime - phaseStartTime) / MILLIS_TO_SECONDS));
         lcd.PrintStr(15,0,"s");
       }
        
-      // Wait in this phase for 40 seconds.  The maximum time in liquidous state is 150 seconds
-      // Max 90 seconds in PHASE_REFLOW + 40 seconds in PHASE_WAITING + some cool down time in PHASE_COOLING_BOARDS_IN is less than 150 seconds.
-      if (currentTime - phaseStartTime > 40 * MILLIS_TO_SECONDS) {
+      // Wait in this phase for SR_WAIT_MINTIME seconds, unless cooling must start now to be back
+      // below liquidus within SR_LIQUIDUS_MAXTIME.
+      if (reflowLiquidus.startCooling()) {
+        Serial.println(F("Cooling early, to limit the time above liquidus"));
+        reflowPhase = PHASE_COOLING_BOARDS_IN;
+        firstTimeInPhase = true;
+      }
+      else if (currentTime - phaseStartTime > readModeSetting(SR_WAIT_MINTIME) * MILLIS_TO_SECONDS) {
         reflowPhase = PHASE_COOLING_BOARDS_IN;
         firstTimeInPhase = true;
       }
@@ -402,23 +360,18 @@ boolean Reflow() {
         lcdPrintLine_P(0, PSTR("Cool - open door"));
         Serial.println(F("******* Phase: Cooling *******"));
         Serial.println(F("Open the oven door ..."));
-        // If a servo is attached, use it to open the door over 10 seconds
-        setServoPosition(getSetting(SETTING_SERVO_OPEN_DEGREES), 10000);
+        // If a servo is attached, the door and the cooling fan are used to cool at SR_COOL_RATE
+        coolStart(sample);
         // Play a tune to let the user know the door should be opened
         playTones(TUNE_REFLOW_DONE);
-
-        // Turn on the cooling fan
-        for (int i=0; i<4; i++) {
-          if (outputType[i] == TYPE_COOLING_FAN)
-            digitalWrite(i+4, HIGH);
-        }
       }
+      coolUpdate(sample);
       // Update the temperature roughly once per second
       if (counter++ % 20 == 0)
         displayReflowTemperature(currentTime, reflowStartTime, phaseStartTime, currentTemperature);
         
       // Boards can be removed once the temperature drops below 100C
-      if (currentTemperature < 100.0) {
+      if (currentTemperature < QDEG(100)) {
         reflowPhase = PHASE_COOLING_BOARDS_OUT;
         firstTimeInPhase = true;
       }
@@ -433,29 +386,49 @@ boolean Reflow() {
         // Play a tune to let the user know the boards can be removed
         playTones(TUNE_REMOVE_BOARDS);
       }
+      coolUpdate(sample);
       // Update the temperature roughly once per second
       if (counter++ % 20 == 0)
         displayReflowTemperature(currentTime, reflowStartTime, phaseStartTime, currentTemperature);
         
-      // Once the temperature drops below 50C a new reflow can be started
-      if (currentTemperature < 50.0) {
+      // Once the oven is cool a new reflow can be started
+      if (currentTemperature < qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE))) {
         reflowPhase = PHASE_ABORT_REFLOW;
+        completed = true;
         lcdPrintLine_P(0, PSTR("Reflow complete!"));
         lcdPrintLine_P(1, PSTR(" "));
       }
       break;
       
     case PHASE_ABORT_REFLOW: // The reflow must be stopped now
-      Serial.println(F("Reflow is done!"));
-      // Turn all elements and fans off
-      for (i = 4; i < 8; i++)
-        digitalWrite(i, LOW);
-      // Close the oven door now, over 3 seconds
-      setServoPosition(getSetting(SETTING_SERVO_CLOSED_DEGREES), 3000);
+      if (!stopped) {
+        stopped = true;
+        Serial.println(F("Reflow is done!"));
+        // Turn all elements and fans off
+        reflowSetElements(0, 0, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_CONVECTION_FAN, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_COOLING_FAN, 0);
+        // Close the oven door now, over 3 seconds
+        setServoPosition(readGlobalSetting(SG_SERVO_RETRACT_DEG), 3000);
+        // Save any duty cycle adjustments, and the end of learning
+        WriteModeConfig();
+        reflowLiquidus.report();
+        // Allow the user to read the last message
+        holdMessage(3000);
+        // Save the run's summary, and show it if the reflow completed
+        if (reflowMetrics.finish(CurrentMode, completed, reflowLiquidus, summary)) {
+          WriteRunLog(summary);
+          PrintRunSummary(summary);
+          if (completed)
+            ShowRunSummary(summary);
+        }
+      }
+      if (messageShowing())
+        break;
       // Start next time with initialization
+      stopped = false;
       reflowPhase = PHASE_INIT;
-      // Wait for a bit to allow the user to read the last message
-      delay(3000);
+      firstTimeInPhase = true;
       // Return to the main menu
       return false;
   }
@@ -466,36 +439,24 @@ boolean Reflow() {
 
 // Adjust the duty cycle for all elements by the given adjustment value
 void adjustPhaseDutyCycle(int phase, int adjustment) {
+  static const uint8_t type[3]  = { TYPE_BOTTOM_ELEMENT, TYPE_BOOST_ELEMENT, TYPE_TOP_ELEMENT };
+  static const uint8_t limit[3] = { REFLOW_MAX_BOTTOM,   REFLOW_MAX_BOOST,   REFLOW_MAX_TOP   };
+  SR_Entries_t dutySetting[3];
+
+  dutySetting[0] = SR_PHASE(phase - PHASE_PRESOAK, BOTTOM_DUTY_CYCLE);
+  dutySetting[1] = SR_PHASE(phase - PHASE_PRESOAK, BOOST_DUTY_CYCLE);
+  dutySetting[2] = SR_PHASE(phase - PHASE_PRESOAK, TOP_DUTY_CYCLE);
+
   sprintf(debugBuffer, "Adjusting duty cycles for %s phase by %d", phaseDescription[phase], adjustment);
   Serial.println(debugBuffer);
-  // Loop through the 4 outputs
-  for (int i=0; i< 4; i++) {
-    int dutySetting = SETTING_PRESOAK_D4_DUTY_CYCLE + ((phase-1) * 4) + i;
-    int newDutyCycle = getSetting(dutySetting) + adjustment;
-
-    switch (getSetting(SETTING_D4_TYPE + i)) {
-      case TYPE_BOOST_ELEMENT:
-        // To avoid overstressing the boost element (which is just a mold heater), don't allow more than a 60% duty cycle
-        // Also, this element is probably not optimally located in the oven and running it too hot may create an imbalance
-        newDutyCycle = constrain(newDutyCycle, 0, 60);
-        break;
-      case TYPE_TOP_ELEMENT:
-        // With IR radiation (if oven has IR elements) and insulation just above it, don't allow more than 80% duty cycle
-        newDutyCycle = constrain(newDutyCycle, 0, 80);
-        break;
-      case TYPE_BOTTOM_ELEMENT:
-        // Allow 100% duty cycle for the bottom element, since all heat will hit the aluminum tray
-        newDutyCycle = constrain(newDutyCycle, 0, 100);
-        break;
-      default:
-        // Skip this output if it isn't a heating element (fan or unused)
-        continue;
-    }
-    
-    sprintf(debugBuffer, "D%d (%s) changed from %d to %d", i+4, outputDescription[getSetting(SETTING_D4_TYPE + i)], getSetting(dutySetting), newDutyCycle);
+  // Loop through the 3 elements
+  for (int i=0; i< 3; i++) {
+    int newDutyCycle = constrain((int)readModeSetting(dutySetting[i]) + adjustment, 0, limit[i]);
+
+    sprintf(debugBuffer, "%s changed from %d to %d", outputDescription[type[i]], readModeSetting(dutySetting[i]), newDutyCycle);
     Serial.println(debugBuffer);
     // Save the new duty cycle
-    setSetting(dutySetting, newDutyCycle);
+    writeModeSetting(dutySetting[i], newDutyCycle);
   }
 }
 
@@ -512,29 +473,30 @@ void lcdPrintPhaseMessage(int phase, const char* str) {
 
 
 // Print data about the phase to the serial port
-void serialDisplayPhaseData(int phase, struct phaseData *pd, int *outputType) {
+void serialDisplayPhaseData(int phase) {
   sprintf(debugBuffer, "******* Phase: %s *******", phaseDescription[phase]);
   Serial.println(debugBuffer);
-  sprintf(debugBuffer, "Minimum duration = %d seconds", pd->phaseMinDuration);
+  sprintf(debugBuffer, "Minimum duration = %d seconds", reflowSetting(phase, MINTIME));
   Serial.println(debugBuffer);
-  sprintf(debugBuffer, "Maximum duration = %d seconds", pd->phaseMaxDuration);
+  sprintf(debugBuffer, "Maximum duration = %d seconds", reflowSetting(phase, MAXTIME));
   Serial.println(debugBuffer);
-  sprintf(debugBuffer, "End temperature = %d Celsius", pd->endTemperature);
+  sprintf(debugBuffer, "End temperature = %d Celsius", reflowSetting(phase, MAXTEMP));
   Serial.println(debugBuffer);
   Serial.println(F("Duty cycles: "));
-  for (int i=0; i<4; i++) {
-    sprintf(debugBuffer, "  D%d = %d  (%s)", i+4, pd->elementDutyCycle[i], outputDescription[outputType[i]]);
-    Serial.println(debugBuffer);
-  }
+  sprintf(debugBuffer, "  Bottom = %d, Boost = %d, Top = %d, Convection Fan = %d",
+          reflowSetting(phase, BOTTOM_DUTY_CYCLE), reflowSetting(phase, BOOST_DUTY_CYCLE),
+          reflowSetting(phase, TOP_DUTY_CYCLE), reflowSetting(phase, CONVFAN_DUTY_CYCLE));
+  Serial.println(debugBuffer);
 }
 
 
 // Display the current temperature to the LCD screen and print it to the serial port so it can be plotted
-void displayReflowTemperature(unsigned long currentTime, unsigned long startTime, unsigned long phaseTime, double temperature) {
+void displayReflowTemperature(unsigned long currentTime, unsigned long startTime, unsigned long phaseTime, qdeg_t temperature) {
   // Write the time and temperature to the serial port, for graphing or analysis on a PC
   sprintf(debugBuffer, "%ld, %ld, ", (currentTime - startTime) / MILLIS_TO_SECONDS, (currentTime - phaseTime) / MILLIS_TO_SECONDS);
   Serial.print(debugBuffer);
-  Serial.println(temperature);
+  printQdeg(temperature);
+  Serial.println();
 }
 
 
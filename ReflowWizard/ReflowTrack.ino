@@ -0,0 +1,362 @@
+// Profile tracking reflow.
+// Follows a target temperature trajectory built from the Current Mode's SR_*
+// settings.  Each of Presoak, Soak and Reflow ramps linearly from the end of
+// the last phase to its MAXTEMP, over the middle of its MINTIME - MAXTIME window.
+// A PID controller tracks the trajectory.  Its output is the power of the phase,
+// 100% being the phase's duty cycles, so they are the feed forward and set the
+// balance between the elements, and existing profiles keep their character.
+// Once the Mode has a learnt oven model, the feed forward is the power the model
+// predicts will keep the oven on the trajectory, a short horizon ahead, rather
+// than 100%.  The model is learnt, or refined, by every run.
+// The time above liquidus and the peak are tracked, and end the reflow ramp, or
+// the waiting, early when needed to stay inside the profile.
+// The run is measured against the trajectory, and its summary saved and shown at the end.
+// Called from the main loop.
+
+#include "PID.h"
+#include "Model.h"
+#include "Liquidus.h"
+#include "Metrics.h"
+#include "Temperature.h"
+
+#define TRACK_REMOVE_TEMP  QDEG(100)  // Boards can be removed below this
+
+enum TRACK_PHASE {
+  TRACK_INIT,             // Check the oven, and load the profile
+  TRACK_PRESOAK,          // Ramp to SR_PRESOAK_MAXTEMP
+  TRACK_SOAK,             // Ramp to SR_SOAK_MAXTEMP
+  TRACK_REFLOW,           // Ramp to SR_REFLOW_MAXTEMP
+  TRACK_WAITING,          // Elements off for SR_WAIT_MINTIME
+  TRACK_COOLING,          // Door open, cooling fan on.  Boards stay in.
+  TRACK_BOARDS_OUT,       // Boards can be removed.  Wait until the oven is cool.
+  TRACK_ABORT,            // Finished or aborted, turn everything off.
+};
+
+ControLeo2_PID       trackPID;
+ControLeo2_OvenModel trackModel;
+ControLeo2_Liquidus  trackLiquidus;
+ControLeo2_RunMetrics trackMetrics;
+uint8_t              trackDuty[MODEL_ELEMENTS]; // Duty cycles the elements are driven at
+
+// Setting of a ramp phase (TRACK_PRESOAK - TRACK_REFLOW)
+#define trackSetting(phase, entry) readModeSetting(SR_PHASE((phase) - TRACK_PRESOAK, entry))
+
+// Set the PID limits so the largest element of the phase can reach 100%,
+// and the phase's convection fan.
+void trackStartPhase(uint8_t phase) {
+  uint8_t balance[MODEL_ELEMENTS];
+
+  trackPhaseDuty(phase, balance);
+  trackPID.setBalanceLimits(balance);
+  relays.SetRelay(ControLeo2_Relays::RELAY_CONVECTION_FAN, trackSetting(phase, CONVFAN_DUTY_CYCLE));
+}
+
+// Duty cycles of the phase, at 100% power.
+void trackPhaseDuty(uint8_t phase, uint8_t duty[MODEL_ELEMENTS]) {
+  duty[0] = trackSetting(phase, BOTTOM_DUTY_CYCLE);
+  duty[1] = trackSetting(phase, BOOST_DUTY_CYCLE);
+  duty[2] = trackSetting(phase, TOP_DUTY_CYCLE);
+}
+
+// Drive the elements at power percent of the phase duty cycles.
+void trackSetPower(uint8_t phase, uint16_t power) {
+  uint8_t balance[MODEL_ELEMENTS];
+
+  trackPhaseDuty(phase, balance);
+  setElementPower(balance, power, trackDuty);
+}
+
+// Feed forward power (percent) the model predicts will follow the trajectory,
+// or 100% until the Mode has a model.
+uint8_t trackFeedForward(uint8_t phase, qdeg_t startTemp, uint32_t trackTime, qdeg_t temperature) {
+  uint8_t  duty[MODEL_ELEMENTS];
+  uint32_t remaining = profileDuration(phase - TRACK_PRESOAK);
+  uint8_t  horizon;
+
+  if (!trackModel.valid()) return 100;
+
+  // Look to the end of the phase, but no closer than changes can be seen, nor further than MODEL_HORIZON.
+  remaining = (remaining > trackTime) ? (remaining - trackTime) / 1000 : 0;
+  horizon   = min(max(remaining, trackModel.model().dead_time + 1UL), (uint32_t)MODEL_HORIZON);
+
+  trackPhaseDuty(phase, duty);
+  return trackModel.predictPower(temperature,
+                                 profileSetpoint(phase - TRACK_PRESOAK, startTemp, trackTime + (horizon * 1000UL)),
+                                 horizon, duty, PID_MAX_POWER);
+}
+
+// Fit the oven model to the run, and save it for the Mode.
+void trackLearn(void) {
+  Oven_Model_t model;
+
+  trackModel.learn(false);
+  if (!trackModel.fit(model)) return;
+  WriteModeModel(CurrentMode, model);
+
+  Serial.print(FM("Oven model: gain "));
+  for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) {
+    Serial.print(model.gain[i]);
+    Serial.print(FM(", "));
+  }
+  Serial.print(FM("loss "));
+  Serial.print(model.loss);
+  Serial.print(FM(", tau "));
+  Serial.print(model.tau);
+  Serial.print(FM(", dead time "));
+  Serial.println(model.dead_time);
+}
+
+void trackPhaseName(uint8_t phase) {
+  switch (phase) {
+    case TRACK_PRESOAK    : lcd.PrintStr(0, 0, FM("Presoak         ")); break;
+    case TRACK_SOAK       : lcd.PrintStr(0, 0, FM("Soak            ")); break;
+    case TRACK_REFLOW     : lcd.PrintStr(0, 0, FM("Reflow          ")); break;
+    case TRACK_WAITING    : lcd.PrintStr(0, 0, FM("Waiting         ")); break;
+    case TRACK_COOLING    : lcd.PrintStr(0, 0, FM("Cool - open door")); break;
+    case TRACK_BOARDS_OUT : lcd.PrintStr(0, 0, FM("Okay to remove  ")); break;
+  }
+}
+
+// Return false to exit this mode
+bool ReflowTrack() {
+  static uint8_t  phase = TRACK_INIT;
+  static qdeg_t   startTemp;        // Temperature the current ramp starts from
+  static uint32_t trackTime;        // Time along the trajectory, in the current phase (ms)
+  static uint32_t phaseStartTime;   // millis() the current phase started
+  static uint32_t reflowStartTime;  // millis() the reflow started
+  static uint32_t lastSampleTime;
+  static uint8_t  lastSequence;
+  static uint16_t lastLogSecond;
+  static qdeg_t   setpoint;
+  static uint8_t  power;
+  static uint8_t  feedforward;
+  static bool     completed;        // The reflow ran to the end
+  static bool     stopped = false;  // Everything is off, waiting for the summary to be read
+
+  Oven_Model_t    model;
+  Run_Summary_t   summary;
+
+  uint32_t currentTime = millis();
+  uint16_t dt;
+
+  const TC_Sample_t& sample = temps.getSample();
+
+  // Abort on a thermocouple fault, over temperature, or a long press of the bottom button.
+  if ((phase != TRACK_INIT) && (phase != TRACK_ABORT)) {
+    if (THERMOCOUPLE_FAULT(sample.fault)) {
+      lcd.PrintStr(0, 0, FM("Thermocouple err"));
+      Serial.print(FM("Reflow aborted, thermocouple error: "));
+      Serial.println(ThermocoupleFaultStr(sample.fault));
+      phase = TRACK_ABORT;
+    } else if (sample.temperature >= qdegFromDegrees(readGlobalSetting(SG_OVER_TEMPERATURE))) {
+      lcd.PrintStr(0, 0, FM("Over temperature"));
+      Serial.println(FM("Reflow aborted, over temperature"));
+      phase = TRACK_ABORT;
+    } else if (buttons.GetKeypress() == BUTTON_BOT_LONG_HOLD) {
+      lcd.PrintStr(0, 0, FM("Aborting reflow "));
+      Serial.println(FM("Button pressed.  Aborting reflow ..."));
+      phase = TRACK_ABORT;
+    }
+  }
+
+  trackLiquidus.update(currentTime, sample.temperature, sample.rate);
+  if ((phase >= TRACK_PRESOAK) && (phase <= TRACK_REFLOW)) {
+    trackMetrics.update(currentTime, phase - TRACK_PRESOAK, setpoint, sample.temperature, sample.rate);
+  } else if (phase == TRACK_WAITING) {
+    trackMetrics.update(currentTime, TRACK_REFLOW - TRACK_PRESOAK, qdegFromDegrees(readModeSetting(SR_REFLOW_MAXTEMP)),
+                        sample.temperature, sample.rate);
+  } else {
+    trackMetrics.update(currentTime, METRICS_NO_TARGET, 0, sample.temperature, sample.rate);
+  }
+
+  switch (phase) {
+    case TRACK_INIT:
+      // Make sure the oven is cool, for a predictable start.
+      if ((THERMOCOUPLE_FAULT(sample.fault)) ||
+          (sample.temperature > qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE)))) {
+        lcd.PrintStr(0, 0, FM("Oven not cool   "));
+        Serial.println(FM("Oven too hot to start reflow.  Please wait ..."));
+        phase = TRACK_ABORT;
+        break;
+      }
+
+      ReadModeConfig(CurrentMode);
+
+      // Reflow ramps need a short, fixed lag on the temperature readings
+      temps.setFilterMode(FILTER_BOXCAR);
+
+      trackPID.setGains(PID_OVEN_KP, PID_OVEN_KI, PID_OVEN_KD);
+      trackPID.reset();
+
+      trackModel.begin(ReadModeModel(CurrentMode, model) ? &model : NULL, sample.temperature);
+      trackModel.learn(true);
+      trackLiquidus.begin(currentTime, qdegFromDegrees(readModeSetting(SR_LIQUIDUS_TEMP)), qdegFromDegrees(readModeSetting(SR_REFLOW_MAXTEMP)),
+                          readModeSetting(SR_LIQUIDUS_MAXTIME), trackModel.valid() ? &trackModel.model() : NULL);
+      trackMetrics.begin(currentTime, qdegFromDegrees(readModeSetting(SR_PRESOAK_MAXTEMP)),
+                         qdegFromDegrees(readModeSetting(SR_SOAK_MAXTEMP)));
+      completed = false;
+      memset(trackDuty, 0, sizeof(trackDuty));
+
+      startTemp       = sample.temperature;
+      trackTime       = 0;
+      reflowStartTime = currentTime;
+      phaseStartTime  = currentTime;
+      lastSampleTime  = sample.time;
+      lastSequence    = sample.sequence;
+      lastLogSecond   = 0;
+      setpoint        = startTemp;
+      power           = 0;
+      feedforward     = 100;
+
+      phase = TRACK_PRESOAK;
+      trackPhaseName(phase);
+      trackStartPhase(phase);
+      Serial.println(FM("Seconds, Setpoint, Temperature, Power, Feed Forward"));
+      break;
+
+    case TRACK_PRESOAK:
+    case TRACK_SOAK:
+    case TRACK_REFLOW:
+      // Only act on new temperature samples.
+      if (sample.sequence == lastSequence) break;
+      lastSequence = sample.sequence;
+      dt = sample.time - lastSampleTime;
+      lastSampleTime = sample.time;
+
+      // Hold the trajectory while the oven is well behind it, so the shape of the
+      // profile is kept, rather than the setpoint running away from the oven.
+      setpoint = profileSetpoint(phase - TRACK_PRESOAK, startTemp, trackTime);
+      if (qdegSub(setpoint, sample.temperature) < PID_HOLD_ERROR) {
+        trackTime += dt;
+      }
+
+      // The derivative acts on how much faster than the trajectory the oven is rising.
+      power = trackPID.update(setpoint, sample.temperature,
+                              sample.rate - profileSlope(phase - TRACK_PRESOAK, startTemp, trackTime), feedforward, dt);
+      trackSetPower(phase, power);
+
+      // Next phase, once the trajectory is finished (and for Reflow, the peak reached).
+      // Reflow ends early if the oven would coast past the peak, or stay above liquidus too long.
+      if (((trackTime >= profileDuration(phase - TRACK_PRESOAK)) &&
+           ((phase != TRACK_REFLOW) || (qdegSub(setpoint, sample.temperature) <= PID_AT_ERROR))) ||
+          ((phase == TRACK_REFLOW) && trackLiquidus.cutHeat())) {
+        startTemp      = setpoint;
+        trackTime      = 0;
+        phaseStartTime = currentTime;
+        phase++;
+        trackPhaseName(phase);
+        if (phase <= TRACK_REFLOW) {
+          trackStartPhase(phase);
+        } else {
+          // Waiting, turn the elements off (keep the convection fan on)
+          trackSetPower(TRACK_REFLOW, 0);
+          power = 0;
+        }
+        break;
+      }
+
+      // The oven can't keep up.
+      if ((currentTime - phaseStartTime) > (trackSetting(phase, MAXTIME) * 1000UL)) {
+        lcd.PrintStr(0, 0, FM("Too slow        "));
+        Serial.println(FM("Aborting reflow.  Oven cannot follow the profile!"));
+        phase = TRACK_ABORT;
+      }
+      break;
+
+    case TRACK_WAITING:
+      // Let the heat soak in, before cooling, unless cooling must start now to be
+      // back below liquidus within SR_LIQUIDUS_MAXTIME.
+      if (((currentTime - phaseStartTime) >= (readModeSetting(SR_WAIT_MINTIME) * 1000UL)) ||
+          trackLiquidus.startCooling()) {
+        trackLearn();
+
+        phase = TRACK_COOLING;
+        phaseStartTime = currentTime;
+        trackPhaseName(phase);
+
+        // Cool at SR_COOL_RATE, with the door and the cooling fan.
+        coolStart(sample);
+        playTones(TUNE_REFLOW_DONE);
+      }
+      break;
+
+    case TRACK_COOLING:
+      coolUpdate(sample);
+      // Boards can be removed without dislodging components once the solder is solid.
+      if (sample.temperature < TRACK_REMOVE_TEMP) {
+        phase = TRACK_BOARDS_OUT;
+        phaseStartTime = currentTime;
+        trackPhaseName(phase);
+        playTones(TUNE_REMOVE_BOARDS);
+      }
+      break;
+
+    case TRACK_BOARDS_OUT:
+      coolUpdate(sample);
+      if (sample.temperature < qdegFromDegrees(readGlobalSetting(SG_COOL_TEMPERATURE))) {
+        lcd.PrintStr(0, 0, FM("Reflow complete!"));
+        completed = true;
+        phase = TRACK_ABORT;
+      }
+      break;
+
+    case TRACK_ABORT:
+      if (!stopped) {
+        stopped = true;
+        Serial.println(FM("Reflow is done!"));
+        trackLiquidus.report();
+        // Turn all elements and fans off, and close the door.
+        relays.SetRelay(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_BOOST_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_TOP_ELEMENT, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_CONVECTION_FAN, 0);
+        relays.SetRelay(ControLeo2_Relays::RELAY_COOLING_FAN, 0);
+        setServoPosition(readGlobalSetting(SG_SERVO_RETRACT_DEG), readGlobalSetting(SG_SERVO_OPEN_TIME) * 100);
+        // Allow the user to read the last message
+        holdMessage(3000);
+        // Save the run's summary, and show it if the reflow completed
+        if (trackMetrics.finish(CurrentMode, completed, trackLiquidus, summary)) {
+          WriteRunLog(summary);
+          PrintRunSummary(summary);
+          if (completed) ShowRunSummary(summary);
+        }
+      }
+      if (messageShowing()) break;
+      // Start next time with initialization
+      stopped = false;
+      phase = TRACK_INIT;
+      return false;
+  }
+
+  // Log and display the progress, once a second.
+  if ((phase > TRACK_INIT) && (phase < TRACK_ABORT) &&
+      (((currentTime - reflowStartTime) / 1000) != lastLogSecond)) {
+    lastLogSecond = (currentTime - reflowStartTime) / 1000;
+
+    if (phase <= TRACK_WAITING) {
+      trackModel.second(sample.temperature, sample.rate, trackDuty);
+    }
+    if (phase <= TRACK_REFLOW) {
+      feedforward = trackFeedForward(phase, startTemp, trackTime, sample.temperature);
+    }
+
+    if (phase <= TRACK_REFLOW) {
+      lcd.PrintInt(6, 1, 3, qdegToDegrees(setpoint));
+      lcd.setChar(9, 1, 0x01);
+      lcd.PrintInt(11, 1, 3, power);
+      lcd.setChar(14, 1, '%');
+    }
+
+    Serial.print(lastLogSecond);
+    Serial.print(FM(", "));
+    Serial.print(qdegToDegrees(setpoint));
+    Serial.print(FM(", "));
+    Serial.print(qdegToDegrees(sample.temperature));
+    Serial.print(FM(", "));
+    Serial.print(power);
+    Serial.print(FM(", "));
+    Serial.println(feedforward);
+  }
+
+  return true;
+}
@@ -80,6 +80,6 @@ const char *bakingPhaseDescription[] = {"", "Heating", "Baking", "", "Cooling",
 #define BAKE_MAX_TEMPERATURE                  200  // Maximum temperature for baking
 
 // Thermocouple
-#define THERMOCOUPLE_FAULT(x)                 (x == FAULT_OPEN || x == FAULT_SHORT_GND || x == FAULT_SHORT_VCC)
+#define THERMOCOUPLE_FAULT(x)                 (x != FAULT_NONE)
 
 #endif // REFLOW_WIZARD_H
@@ -117,12 +117,14 @@
 #include "LcdFont.h"
 #include "Tones.h"
 #include "Menu.h"
+#include "Trace.h"
+#include "Temperature.h"
 
 // ***** TYPE DEFINITIONS *****
 
 ControLeo2_LCD       lcd;
 ControLeo2_Buttons   buttons;
-ControLeo2_MAX31855  temps;
+ControLeo2_Thermocouples temps;
 ControLeo2_Relays    relays;
 
 int mode = 0;
@@ -156,11 +158,18 @@ void setup() {
       
     delay(100);
     playTones(TUNE_STARTUP);
-    delay(3000);
+    for (unsigned long start = millis(); (millis() - start) < 3000; )
+        serviceTones();
 
     // Read the global configuration values
     ReadGlobalConfig();
 
+    // Restore the relay wear counters
+    ReadRelayLog();
+
+    // Start the relay PWM
+    relays.begin();
+
     // Initialize the timer used to control the servo
     initializeServo();
 
@@ -202,13 +211,93 @@ const char* const modes[NO_OF_MODES] PROGMEM = {("Test Outputs?"),
 
 #define DISPLAY_REFRESH_RATE_HZ (20)
 
+// Timed messages.
+// A message is left on the LCD for a time while the loop keeps running, so the
+// temperatures, relays and buttons are still serviced while the user reads it.
+// Nothing else should be drawn on the LCD while messageShowing().
+unsigned long messageStart;
+unsigned int  messageDuration = 0;
+
+// Keep what is on the LCD now, for ms.
+void holdMessage(unsigned int ms)
+{
+    messageStart    = millis();
+    messageDuration = ms;
+}
+
+// Show a message (either line may be NULL, to leave it as it is), for ms.
+void showMessage(const __FlashStringHelper* line0, const __FlashStringHelper* line1, unsigned int ms)
+{
+    if (line0 != NULL) lcd.PrintStr(0, 0, line0);
+    if (line1 != NULL) lcd.PrintStr(0, 1, line1);
+    holdMessage(ms);
+}
+
+boolean messageShowing()
+{
+    if ((messageDuration != 0) && ((millis() - messageStart) >= messageDuration))
+        messageDuration = 0;
+    return (messageDuration != 0);
+}
+
+// Longest time between calls of loop(), since the last 'l' command.
+unsigned long loopPeriodMax = 0;
+
+// Print, and start measuring again, the longest loop period.
+void PrintLoopPeriod()
+{
+    Serial.print(FM("Longest loop: "));
+    Serial.print(loopPeriodMax);
+    Serial.println(FM("us"));
+    loopPeriodMax = 0;
+}
+
+// Print, and start measuring again, the relay step timing.
+void PrintRelayJitter()
+{
+    Relay_Jitter_t jitter;
+
+    relays.GetJitter(jitter);
+    relays.ResetJitter();
+
+    Serial.print(FM("Relay steps: "));
+    Serial.print(jitter.ticks);
+    Serial.print(FM(", late "));
+    Serial.print(jitter.late);
+    Serial.print(FM(", min "));
+    Serial.print(jitter.min_us);
+    Serial.print(FM("us, max "));
+    Serial.print(jitter.max_us);
+    Serial.print(FM("us, mean error "));
+    Serial.print((jitter.ticks != 0) ? (jitter.error_us / jitter.ticks) : 0);
+    Serial.println(FM("us"));
+}
+
+// Single character commands from the serial port.
+// 'r' prints the relay wear counters, 'l' the longest loop period, 'm' the last run summaries,
+// 'j' the relay step timing, the rest are trace commands.
+void serialCommands()
+{
+    char command;
+
+    while (Serial.available() > 0) {
+        command = Serial.read();
+        switch (command) {
+            case 'r' : PrintRelayLog();          break;
+            case 'l' : PrintLoopPeriod();        break;
+            case 'm' : PrintRunLog();            break;
+            case 'j' : PrintRelayJitter();       break;
+            default  : TRACE_COMMAND(command);   break;
+        }
+    }
+}
+
 // Refresh Periodic tasks, Thermocouple reading, Screen Overlay, Screen Drawing, Key Handling
 void refresh()
 {
     // Call this in the main loop, will cause display and temps to be updated as required.
     static unsigned long previous_time = 0;
     unsigned long current_time  = micros();
-    int16_t temperature;
 
     // Get newest temperature data, as required.
     temps.RefreshTemps();
@@ -216,15 +305,25 @@ void refresh()
     // Refresh Relay PWM, as required.
     relays.ProcessRelays();
 
+    // Handle serial commands, and send any relay trace records, as the serial port allows.
+    serialCommands();
+    TRACE_SERVICE();
+
+    // Save the relay wear counters, as required.
+    ServiceRelayLog();
+
+    // Play the next note of a tune, as required.
+    serviceTones();
+
     // Put a Temperature Overlay on the LCD Screen Data and Redraw the LCD 
     // at the required refresh rate.
     if ((current_time - previous_time) >= (1000000 / DISPLAY_REFRESH_RATE_HZ)) {
         // Get Latest Temperature Readings.
         // Draw Temperature Overlay on screen.
         // Temp is always shown in bottom left corner, and consumes 5 Characters.
-        temperature = temps.readThermocouple(0);
-        if (temperature < MAX_TEMPERATURE) {
-            lcd.PrintInt(0,1,3,temps.readThermocouple(0));
+        const TC_Sample_t& sample = temps.getSample();
+        if (sample.fault == FAULT_NONE) {
+            lcd.PrintInt(0,1,3,qdegToDegrees(sample.temperature));
             lcd.setChar(3, 1, 0x01); // Temperature Marking (Degrees C)
             lcd.setChar(4, 1, temps.readThermocoupleDrift()); // Temp Direction
         } else {
@@ -249,6 +348,14 @@ void loop()
   static int counter = 0;
   static unsigned long nextLoopTime = 50; // Should be 3000 + 100 + fudge factor + 50 - but no harm making it 50!
 #endif
+  static unsigned long lastLoopTime = 0;
+  unsigned long loopTime = micros();
+
+  // Measure the loop period, nothing should hold up the loop for long.
+  if ((lastLoopTime != 0) && ((loopTime - lastLoopTime) > loopPeriodMax))
+    loopPeriodMax = loopTime - lastLoopTime;
+  lastLoopTime = loopTime;
+
   refresh();
 
   // Simple Heater Test
@@ -12,6 +12,44 @@
 
 #define PWM_MIN_FREQ_US  ((1000000 * AC_HZ_MIN_CYCLES) / AC_HALF_WAVE_HZ)
                                           // Microseconds per SSR Update for PWM
+#define PWM_STEPS        (100)            // Steps in a full PWM cycle
+#define PHYSICAL_RELAYS  (4)              // D4 to D7
+
+// The relays are normally stepped by ProcessRelays, from the main loop, so a
+// slow LCD refresh, delay() or tune delays them.  Timer driven, they are
+// stepped from the Timer4 overflow interrupt instead, and ProcessRelays only
+// rebuilds the pattern.  Timer4 is then not available for analogWrite (D6, D13).
+//#define RELAY_TIMER_DRIVEN              // Uncomment to step the relays from Timer4
+
+#define RELAY_TIMER_TOP  ((((F_CPU / 1024) * PWM_MIN_FREQ_US) + 500000UL) / 1000000UL - 1)
+                                          // Timer4 counts (CK/1024) per PWM step, 10 bit
+#define RELAY_LATE_US    (PWM_MIN_FREQ_US + (PWM_MIN_FREQ_US / 2))
+                                          // A step this long after the last is late
+
+// Bit of each relay in the output pattern.  Arranged so the bits for each
+// port are already in place (PD4, PD7, PE6), or need one shift (PC6).
+#define RELAY_BIT_D4     _BV(4)           // PD4
+#define RELAY_BIT_D5     _BV(0)           // PC6
+#define RELAY_BIT_D6     _BV(7)           // PD7
+#define RELAY_BIT_D7     _BV(6)           // PE6
+
+// Timing of the relay PWM steps, to measure how regularly they happen.
+// Printed by the 'j' serial command.
+typedef struct Relay_Jitter_t {
+  uint16_t ticks;                         // Steps measured
+  uint16_t late;                          // Steps later than RELAY_LATE_US
+  uint16_t min_us;                        // Shortest step
+  uint16_t max_us;                        // Longest step (0xFFFF = 65ms or more)
+  uint32_t error_us;                      // Sum of |step - PWM_MIN_FREQ_US|, mean = error_us / ticks
+} Relay_Jitter_t;
+
+// Wear of each physical relay, and the load it switches.
+typedef struct Relay_Counters_t {
+  uint32_t switches[PHYSICAL_RELAYS];     // Times turned on
+  uint32_t on_steps[PHYSICAL_RELAYS];     // PWM steps on (PWM_MIN_FREQ_US each)
+} Relay_Counters_t;
+
+#define RELAY_STEPS_PER_HOUR (3600000000UL / PWM_MIN_FREQ_US)
 
 class ControLeo2_Relays {
 
@@ -31,20 +69,57 @@ class ControLeo2_Relays {
       RELAY_D7,             // Physical Relay - Relay Switch on IO D7
     };
 
+    enum MODULATION {
+      MODULATION_PWM,         // Slow PWM, on time grouped in 4 blocks per PWM cycle. Fewest switches.
+      MODULATION_SIGMA_DELTA, // On time spread as evenly as AC_HZ_MIN_CYCLES allows. Least ripple.
+    };
+
     ControLeo2_Relays(void);
+    void begin(void);
     
     void AssignRelay(RELAY Phys, RELAY Virt);
     void SetRelay(RELAY relay, uint8_t duty);
+    void SetModulation(RELAY type, MODULATION mode);
+    void ReadSettings(void);
 
     void ProcessRelays(void);
+    void StepRelays(void);  // Called by ProcessRelays, or the Timer4 interrupt
+
+    void GetJitter(Relay_Jitter_t& jitter);
+    void ResetJitter(void);
+
+    void GetCounters(Relay_Counters_t& counters);
+    void SetCounters(const Relay_Counters_t& counters);
 
   private:
     uint32_t lastRelayTime; // Relay Timer
     uint8_t  PWMCounter;    // PWM State Counter (0-99)
 
-    RELAY   RelayAssignment[RELAY_TOP_ELEMENT]; // Virtual to Physical Mapping
-    
-    uint8_t RelayDuty[(RELAY_D7 - RELAY_D4) + 1];      
+    volatile uint8_t CurrentOutputs; // Last outputs written (RELAY_BIT_Dx)
+    Relay_Jitter_t   Jitter;
+    Relay_Counters_t Counters;
+
+    // Compiled relay table, rebuilt when the assignments or settings change.
+    RELAY      RelayType[PHYSICAL_RELAYS];             // Virtual relay each physical relay is assigned to
+    uint16_t   RelayScale[PHYSICAL_RELAYS];            // Maximum power (256 = 100%)
+    uint8_t    RelayLoad[PHYSICAL_RELAYS];             // Power drawn when on (POWER_UNIT_W), 0 = Not counted
+    uint8_t    CircuitLimit;                           // Most power drawn at once (POWER_UNIT_W), 0 = No limit
+    MODULATION RelayModulation[PHYSICAL_RELAYS];       // Modulation of each physical relay
+    uint8_t    VirtualOutputs[RELAY_TOP_ELEMENT + 1];  // Physical relays driven by each virtual relay (bit 0 = D4)
+
+    uint8_t    RelayDuty[PHYSICAL_RELAYS];             // Requested duty, before maximum power scaling
+
+    MODULATION TypeModulation[RELAY_TOP_ELEMENT + 1];  // Modulation used by each type of relay
+
+    uint8_t    RelayPatterns[2][PWM_STEPS];            // Outputs for each PWM step (RELAY_BIT_Dx), stepped and next
+    volatile uint8_t ActivePattern;                    // RelayPatterns being stepped
+    bool       PatternDirty;                           // RelayPatterns needs rebuilding
+
+    void CompileRelays(void);
+    bool isBudgeted(uint8_t relay);
+    uint16_t StepLoad(uint8_t outputs);
+    void BuildPattern(void);
+    void WriteOutputs(uint8_t outputs);
 };
 
 
@@ -1,124 +1,431 @@
 // Relay Management and Control
 
 #include "Relays.h"
+#include "Trace.h"
+
+// Pattern bit of each physical relay.
+const PROGMEM uint8_t RelayBit[PHYSICAL_RELAYS] = {
+  RELAY_BIT_D4, RELAY_BIT_D5, RELAY_BIT_D6, RELAY_BIT_D7
+};
+
+// Default modulation of each type of relay.
+// Elements use Sigma-Delta, to minimise temperature ripple.
+// Fans use PWM, so they are switched as little as possible.
+const PROGMEM uint8_t DefaultModulation[ControLeo2_Relays::RELAY_TOP_ELEMENT + 1] = {
+  ControLeo2_Relays::MODULATION_PWM,          // RELAY_UNUSED
+  ControLeo2_Relays::MODULATION_PWM,          // RELAY_COOLING_FAN
+  ControLeo2_Relays::MODULATION_PWM,          // RELAY_CONVECTION_FAN
+  ControLeo2_Relays::MODULATION_SIGMA_DELTA,  // RELAY_BOTTOM_ELEMENT
+  ControLeo2_Relays::MODULATION_SIGMA_DELTA,  // RELAY_BOOST_ELEMENT
+  ControLeo2_Relays::MODULATION_SIGMA_DELTA,  // RELAY_TOP_ELEMENT
+};
       
 ControLeo2_Relays::ControLeo2_Relays(void) {
-  for (uint8_t i = RELAY_COOLING_FAN; i <= RELAY_D7; i++) {
-    // Array only has Physical entries, so adjust the index accordingly.
-    if (i <= RELAY_TOP_ELEMENT) {
-      RelayAssignment[i-1] = RELAY_UNUSED;
-    } else {
-      // Initialise Relay Driver Outputs
-      pinMode(4 + i - RELAY_D4, OUTPUT);
-      digitalWrite(4 + i - RELAY_D4, LOW);   
-      RelayDuty[i - RELAY_D4] = 0; // Default to 0% Duty Cycle (Relay off)
-    }
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    // Initialise Relay Driver Outputs
+    pinMode(4 + i, OUTPUT);
+    digitalWrite(4 + i, LOW);   
+    RelayDuty[i] = 0;             // Default to 0% Duty Cycle (Relay off)
+    RelayType[i] = RELAY_UNUSED;  // Until the settings are read
+    RelayScale[i] = 0;
+    RelayLoad[i] = 0;
+  }
+  CircuitLimit = 0;
+
+  for (uint8_t i = RELAY_UNUSED; i <= RELAY_TOP_ELEMENT; i++) {
+    TypeModulation[i] = (MODULATION)pgm_read_byte(&DefaultModulation[i]);
   }
   
   PWMCounter = 0;
+  lastRelayTime = 0;
+  CurrentOutputs = 0;
+  memset(RelayPatterns, 0, sizeof(RelayPatterns));
+  ActivePattern = 0;
+  ResetJitter();
+  memset(&Counters, 0, sizeof(Counters));
+
+  CompileRelays();
 }
 
-// Assign a physical relay to a virtual Relay
+// Start stepping the relays.  Call from setup(), after init() has set up the timers.
+void ControLeo2_Relays::begin(void) {
+#ifdef RELAY_TIMER_DRIVEN
+  uint8_t sreg = SREG;
+  cli();
+  TCCR4B = 0;                                   // Stop Timer4
+  TCCR4A = 0;                                   // No compare outputs
+  TCCR4C = 0;
+  TCCR4D = 0;                                   // Normal mode, TOP = OCR4C
+  TCCR4E = 0;
+  TC4H   = RELAY_TIMER_TOP >> 8;                // 10 bit, high byte first
+  OCR4C  = RELAY_TIMER_TOP & 0xFF;
+  TC4H   = 0;
+  TCNT4  = 0;
+  TIFR4  = _BV(TOV4);                           // Clear any pending overflow
+  TIMSK4 = _BV(TOIE4);                          // Step the relays on overflow
+  TCCR4B = _BV(CS43) | _BV(CS41) | _BV(CS40);   // CK/1024
+  SREG = sreg;
+#endif
+}
+
+// Read the relay types and maximum powers from the Global Settings.
+// Call whenever they change.
+void ControLeo2_Relays::ReadSettings(void) {
+  uint8_t max_pwr;
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    RelayType[i] = (RELAY)readGlobalSetting((SG_Entries_t)(SG_D4_TYPE + i));
+    if (RelayType[i] > RELAY_TOP_ELEMENT) {
+      RelayType[i] = RELAY_UNUSED;
+    }
+
+    // Rescale the Relays Power to match the MAXIMUM Power allowed on the Relay.
+    // So for example, if the Boost Element is set at 60%, then setting
+    // its Duty cycle to 100% will result in a Duty Cycle of 60% = 60% of Power.
+    // Duty=50%, Power=60%, Resultant Duty = 30% (50% of Maximum Power), and so on.
+    // Max Power is Zero, so never turn on the relay.
+    max_pwr = min(readGlobalSetting((SG_Entries_t)(SG_D4_MAXPWR + i)), 100);
+    RelayScale[i] = ((max_pwr * 256) + 50) / 100; // 256 = 100%
+
+    RelayLoad[i] = readGlobalSetting((SG_Entries_t)(SG_D4_WATTS + i)) / POWER_UNIT_W;
+  }
+
+  CircuitLimit = readGlobalSetting(SG_CIRCUIT_WATTS) / POWER_UNIT_W;
+
+  CompileRelays();
+}
+
+// Build the virtual relay fan out, and the modulation of each physical relay.
+void ControLeo2_Relays::CompileRelays(void) {
+  memset(VirtualOutputs, 0, sizeof(VirtualOutputs));
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    if (RelayType[i] != RELAY_UNUSED) {
+      VirtualOutputs[RelayType[i]] |= _BV(i);
+    }
+    RelayModulation[i] = TypeModulation[RelayType[i]];
+  }
+
+  PatternDirty = true;
+}
+
+// Set how a type of relay (Element or Fan) is modulated.
+void ControLeo2_Relays::SetModulation(ControLeo2_Relays::RELAY type, ControLeo2_Relays::MODULATION mode) {
+  if ((type <= RELAY_TOP_ELEMENT) && (TypeModulation[type] != mode)) {
+    TypeModulation[type] = mode;
+    CompileRelays();
+  }
+}
+
+// Assign a physical relay to a virtual Relay.
+// Several physical relays can be assigned the same virtual relay, for example
+// two bottom elements, and are then all driven together.
 void ControLeo2_Relays::AssignRelay(ControLeo2_Relays::RELAY Phys, ControLeo2_Relays::RELAY Virt) {
-  if ((Phys >= RELAY_D4) && (Virt < RELAY_D4)) {
-    RelayAssignment[Virt-1] = Phys; // Virt is -1 because there is no "virtual" UNUSED Relay.
+  if ((Phys >= RELAY_D4) && (Phys <= RELAY_D7) && (Virt <= RELAY_TOP_ELEMENT)) {
+    RelayType[Phys - RELAY_D4] = Virt;
+    CompileRelays();
   }
 }
 
+// Set the duty cycle (0-100%) of a virtual relay (all the physical relays
+// assigned to it), or of a single physical relay.
+// Only stores the duty, the output pattern is rebuilt by ProcessRelays.
 void ControLeo2_Relays::SetRelay(ControLeo2_Relays::RELAY relay, uint8_t duty) {
-  uint8_t max_pwr;
+  uint8_t outputs;
   
   duty = min(duty,100);
   
-  if ((relay > RELAY_UNUSED) && (relay <= RELAY_TOP_ELEMENT)) {
-    relay = RelayAssignment[relay-1]; // Convert Virtual Relay to Physical Relay
+  if ((relay >= RELAY_D4) && (relay <= RELAY_D7)) {
+    outputs = _BV(relay - RELAY_D4);
+  } else if (relay <= RELAY_TOP_ELEMENT) {
+    outputs = VirtualOutputs[relay]; // Unused drives nothing.
+  } else {
+    return;
   }
 
-  if (relay >= RELAY_D4) { // Here we should only have a Physical Relay, or an Unused Relay
-    // Do nothing unless its a physical relay, ignore Unused ones.
-          
-    // Convert relay to be from 0-4.
-    relay = (ControLeo2_Relays::RELAY)(relay - RELAY_D4);
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    if ((outputs & _BV(i)) && (RelayDuty[i] != duty)) {
+      TRACE_RELAY_SET(i, duty, (duty * RelayScale[i]) >> 8);
+      RelayDuty[i] = duty; // Set New Duty Cycle.
+      PatternDirty = true;
+    }
+  }
+}
 
-    Serial.print("Relay ");
-    Serial.print(relay);
+// Is the relay counted against the circuit power limit.
+bool ControLeo2_Relays::isBudgeted(uint8_t relay) {
+  return ((CircuitLimit != 0) && (RelayLoad[relay] != 0));
+}
 
-    max_pwr = readGlobalSetting((SG_Entries_t)(SG_D4_MAXPWR + relay));
+// Power drawn by a set of relay outputs (POWER_UNIT_W).
+uint16_t ControLeo2_Relays::StepLoad(uint8_t outputs) {
+  uint16_t load = 0;
 
-    Serial.print(" max_pwr = ");
-    Serial.print(max_pwr);
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    if (outputs & pgm_read_byte(&RelayBit[i])) {
+      load += RelayLoad[i];
+    }
+  }
+  return load;
+}
 
-    Serial.print(" duty = ");
-    Serial.print(duty);
+// Work out the relay outputs for every step of the PWM cycle, from the duty,
+// maximum power and modulation of each relay.  Only done when these change,
+// so each PWM step is just a lookup.
+// The pattern is built in the buffer not being stepped, then swapped in, so
+// when timer driven the interrupt never steps a half built pattern.
+//
+// With a circuit power limit, relays with a load set are scheduled so the
+// relays on in any step never draw more than the limit.  They are Sigma-Delta
+// scheduled, whatever their modulation, so on time can be moved: each step the
+// relays owed the most on time are turned on, while they fit.  On time that
+// can't be given in its step is owed, and given in a later step with room.
+// A relay that needs every step left in the cycle goes first, so each relay
+// still gets its duty, as long as the relays can be fitted in the limit.
+// A relay whose load alone is over the limit is never turned on.
+void ControLeo2_Relays::BuildPattern(void) {
+  uint8_t  local_PWMCounter[PHYSICAL_RELAYS];
+  int16_t  error[PHYSICAL_RELAYS];
+  uint8_t  power[PHYSICAL_RELAYS];
+  uint8_t  remaining[PHYSICAL_RELAYS];
+  uint8_t  dutyAdjust;
+  uint8_t  phaseDuty;
+  uint8_t  outputs;
+  uint8_t  bit;
+  uint16_t load;
+  int8_t   next;
+  bool     on;
+  bool     forced;
+  bool     nextForced;
 
-    if (max_pwr == 0) { // Max Power is Zero, so never turn on the relay.
-      duty = 0; 
-    } else if (max_pwr < 100) { // Max Power less than 100, so scale power down to that range.
-      // Rescale the Relays Power to match the MAXIMUM Power allowed on the Relay.
-      // So for example, if the Boost Element is set at 60%, then setting
-      // its Duty cycle to 100% will result in a Duty Cycle of 60% = 60% of Power.
-      // Duty=50%, Power=60%, Resultant Duty = 30% (50% of Maximum Power), and so on.
-      
-      duty = map(duty, 0, 100, 0, max_pwr);
-    } // Otherwise max_pwr = 100, so do not alter power settings.
+  const uint8_t dutySpread[4] = {0,2,1,3};
+
+  uint8_t  next_pattern = ActivePattern ^ 1;
+  uint8_t* pattern = RelayPatterns[next_pattern];
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    power[i] = (RelayDuty[i] * RelayScale[i]) >> 8;
+    remaining[i] = power[i];
+
+    // Each Relay is offset by 6 PWM Steps, to spread the turnon/off over the one second sub interval.
+    // We do this to help reduce power surges from turning on all heating elements simultaneously.
+    local_PWMCounter[i] = (i * 6) % PWM_STEPS;
+    // For Sigma-Delta, each relay starts at a different error, for the same reason.
+    error[i] = i * 25;
+  }
+
+  for (uint8_t step = 0; step < PWM_STEPS; step++) {
+    outputs = 0;
+
+    for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+      if (isBudgeted(i)) {
+        // Scheduled below, once the unbudgeted relays are known.
+        error[i] += power[i];
+        on = false;
+      } else if (RelayModulation[i] == MODULATION_SIGMA_DELTA) {
+        // Sigma-Delta (Bresenham).  Accumulate the duty every step, and turn on
+        // for a step whenever a whole step of on time is owed.  Each step is
+        // AC_HZ_MIN_CYCLES half waves, so on time is spread as evenly as it can be.
+        // Exactly duty steps are on, so the pattern repeats every PWM cycle.
+        error[i] += power[i];
+        on = (error[i] >= 100);
+        if (on) error[i] -= 100;
+      } else {
+        // Which phase in the 100 state PWM are we in, 0-3.
+        dutyAdjust = local_PWMCounter[i] / 25;    
+
+        // Create a Current Duty relative to the current phase.
+        // Spreads the expected Duty evenly over 4 sub phases, rather than
+        // clustering the duty into the bottom of the entire PWM state.
+        phaseDuty = (dutyAdjust * 25) + ((power[i] + dutySpread[dutyAdjust]) >> 2); // Div 4
+
+        on = (phaseDuty > local_PWMCounter[i]);
+      }
+
+      if (on) {
+        outputs |= pgm_read_byte(&RelayBit[i]);
+      }
 
-    Serial.print(" power = ");
-    Serial.println(duty);
+      local_PWMCounter[i]++;
+      if (local_PWMCounter[i] >= PWM_STEPS) local_PWMCounter[i] = 0;
+    }
+
+    // Turn on the budgeted relays owed a step, most owed first, while they fit.
+    load = StepLoad(outputs);
+    do {
+      next = -1;
+      nextForced = false;
+      for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+        if ((!isBudgeted(i)) || (remaining[i] == 0) ||
+            ((outputs & pgm_read_byte(&RelayBit[i])) != 0) ||
+            ((load + RelayLoad[i]) > CircuitLimit)) continue;
+
+        forced = (remaining[i] >= (PWM_STEPS - step));
+        if ((error[i] < 100) && (!forced)) continue;
+
+        if ((next < 0) || (forced > nextForced) ||
+            ((forced == nextForced) && (error[i] > error[next]))) {
+          next = i;
+          nextForced = forced;
+        }
+      }
+      if (next >= 0) {
+        outputs |= pgm_read_byte(&RelayBit[next]);
+        load += RelayLoad[next];
+        error[next] -= 100;
+        remaining[next]--;
+      }
+    } while (next >= 0);
+
+    pattern[step] = outputs;
+  }
+
+  // Give any on time still owed in steps with room, so the duty is met.
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    if (!isBudgeted(i)) continue;
+
+    bit = pgm_read_byte(&RelayBit[i]);
+
+    for (uint8_t step = 0; (step < PWM_STEPS) && (remaining[i] > 0); step++) {
+      outputs = pattern[step];
+      if (((outputs & bit) == 0) &&
+          ((StepLoad(outputs) + RelayLoad[i]) <= CircuitLimit)) {
+        pattern[step] = outputs | bit;
+        remaining[i]--;
+      }
+    }
+  }
+
+  // Step the new pattern from the next PWM step.
+  uint8_t sreg = SREG;
+  cli();
+  ActivePattern = next_pattern;
+  SREG = sreg;
+}
+
+// Set all the relay outputs at once.  One masked write per port, with
+// interrupts held off, as the servo and tone ISRs also write PORTD and PORTC.
+void ControLeo2_Relays::WriteOutputs(uint8_t outputs) {
+#if (RELAY_OUTPUT_1 == 4) && (RELAY_OUTPUT_2 == 5) && (RELAY_OUTPUT_3 == 6) && (RELAY_OUTPUT_4 == 7)
+  uint8_t sreg = SREG;
+  cli();
+  PORTD = (PORTD & ~(RELAY_BIT_D4 | RELAY_BIT_D6)) | (outputs & (RELAY_BIT_D4 | RELAY_BIT_D6));
+  PORTC = (PORTC & ~_BV(PORTC6)) | ((outputs & RELAY_BIT_D5) << PORTC6);
+  PORTE = (PORTE & ~_BV(PORTE6)) | (outputs & RELAY_BIT_D7);
+  SREG = sreg;
+#else
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    digitalWrite(4 + i, (outputs & pgm_read_byte(&RelayBit[i])) ? HIGH : LOW);
+  }
+#endif
+}
+
+// Advance one PWM step, count relay wear, and record how long since the last step.
+void ControLeo2_Relays::StepRelays(void) {
+  uint32_t now = micros();
+  uint32_t period = now - lastRelayTime;
+  uint16_t error;
+  uint8_t  outputs;
+  uint8_t  bit;
+
+  PWMCounter++; // Next PWM State
+  if (PWMCounter >= PWM_STEPS) PWMCounter = 0; // Wrap PWM at end of range (0-99)
+
+  outputs = RelayPatterns[ActivePattern][PWMCounter];
+  WriteOutputs(outputs);
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    bit = pgm_read_byte(&RelayBit[i]);
+    if (outputs & bit) {
+      Counters.on_steps[i]++;
+      if ((CurrentOutputs & bit) == 0) Counters.switches[i]++;
+    }
+  }
+  CurrentOutputs = outputs;
+
+  // The first step has nothing to measure from.
+  if (lastRelayTime != 0) {
+    if (period > 0xFFFF) period = 0xFFFF;
+
+    error = (period > PWM_MIN_FREQ_US) ? (period - PWM_MIN_FREQ_US) : (PWM_MIN_FREQ_US - period);
     
-    RelayDuty[relay] = duty; // Set New Duty Cycle.
+    if (Jitter.ticks < 0xFFFF) {
+      Jitter.ticks++;
+      Jitter.error_us += error;
+      if (period > RELAY_LATE_US) Jitter.late++;
+      if (period < Jitter.min_us) Jitter.min_us = period;
+      if (period > Jitter.max_us) Jitter.max_us = period;
+    }
   }
-  
+  lastRelayTime = now;
+}
+
+// Copy the step timing, the timer interrupt may be updating it.
+void ControLeo2_Relays::GetJitter(Relay_Jitter_t& jitter) {
+  uint8_t sreg = SREG;
+  cli();
+  jitter = Jitter;
+  SREG = sreg;
+}
+
+void ControLeo2_Relays::ResetJitter(void) {
+  uint8_t sreg = SREG;
+  cli();
+  Jitter.ticks    = 0;
+  Jitter.late     = 0;
+  Jitter.min_us   = 0xFFFF;
+  Jitter.max_us   = 0;
+  Jitter.error_us = 0;
+  SREG = sreg;
+}
+
+// Copy the relay wear counters, the timer interrupt may be updating them.
+void ControLeo2_Relays::GetCounters(Relay_Counters_t& counters) {
+  uint8_t sreg = SREG;
+  cli();
+  counters = Counters;
+  SREG = sreg;
+}
+
+// Restore the relay wear counters, from the EEPROM log.
+void ControLeo2_Relays::SetCounters(const Relay_Counters_t& counters) {
+  uint8_t sreg = SREG;
+  cli();
+  Counters = counters;
+  SREG = sreg;
 }
 
 void ControLeo2_Relays::ProcessRelays(void) {
-  uint8_t local_PWMCounter;
-  uint8_t dutyAdjust;
-  uint8_t phaseDuty;
+  // Rebuild the pattern once, however many relays changed.
+  if (PatternDirty) {
+    PatternDirty = false;
+    BuildPattern();
+  }
 
-  const uint8_t dutySpread[4] = {0,2,1,3};
-  
-  auto incPWM = [&]( uint8_t PWM, uint8_t inc ) -> uint8_t
-  {
-    PWM += inc;
-    if (PWM > 99) PWM -= 100; // Wrap PWM at end of range (0-99)
-    return PWM;
-  };
-  
+#ifndef RELAY_TIMER_DRIVEN
   // Handle the Relay Slow PWM.
   if (lastRelayTime + PWM_MIN_FREQ_US <= micros()) {
-    lastRelayTime = micros();
-    
-    PWMCounter = incPWM(PWMCounter,1); // Next PWM State
-    local_PWMCounter = PWMCounter;
-
-    for (uint8_t i = 0; i < sizeof(RelayDuty); i++) {
-      // Which phase in the 100 state PWM are we in, 0-3.
-      dutyAdjust = local_PWMCounter / 25;    
-
-      // Create a Current Duty relative to the current phase.
-      // Spreads the expected Duty evenly over 4 sub phases, rather than
-      // clustering the duty into the bottom of the entire PWM state.
-      phaseDuty = (dutyAdjust * 25) + ((RelayDuty[i] + dutySpread[dutyAdjust]) >> 2); // Div 4
-     
-      if (phaseDuty > local_PWMCounter) {
-        Serial.print((i*20)+10); 
-        Serial.print("\t");
-        
-        // Assert Relay
-        digitalWrite(4 + i, HIGH);   
-      } else {
-        Serial.print((i*20)); 
-        Serial.print("\t");
-        
-        // Negate Relay
-        digitalWrite(4 + i, LOW);   
-      }
+    StepRelays();
+  }
+#endif
 
-      // Each Relay is offset by 6 PWM Steps, to spread the turnon/off over the one second sub interval.
-      // We do this to help reduce power surges from turning on all heating elements simultaneously.
-      local_PWMCounter = incPWM(local_PWMCounter,6);       
-    }
-    Serial.println();
+#ifdef RELAY_TRACE
+  // Only trace when an output changes.
+  // Not traced from the timer interrupt, so when timer driven, changes
+  // between calls are only seen as the latest outputs.
+  static uint8_t lastOutputs = 0;
+  uint8_t outputs = CurrentOutputs;
+  if (outputs != lastOutputs) {
+    TRACE_RELAY_OUTPUTS(PWMCounter, outputs);
+    lastOutputs = outputs;
   }
+#endif
 }
 
+#ifdef RELAY_TIMER_DRIVEN
+static_assert(RELAY_TIMER_TOP <= 1023, "PWM step too long for Timer4");
+
+ISR(TIMER4_OVF_vect) {
+  relays.StepRelays();
+}
+#endif
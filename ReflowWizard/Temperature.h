@@ -0,0 +1,55 @@
+#ifndef __TEMPERATURE_H__
+#define __TEMPERATURE_H__
+
+// Fixed point temperatures.
+// The control code works in Quarter Degrees, as TC_Sample_t does, so it never
+// needs floating point.  Settings in Degrees are converted once, with helpers
+// that saturate rather than overflow.
+
+typedef int16_t qdeg_t;                           // Quarter Degrees
+
+#define QDEG_MAX        ((qdeg_t)INT16_MAX)
+#define QDEG_MIN        ((qdeg_t)INT16_MIN)
+#define QDEG(DEGREES)   ((qdeg_t)((DEGREES) * 4)) // Constant Degrees
+
+inline qdeg_t qdegSaturate(int32_t value) {
+  if (value > QDEG_MAX) return QDEG_MAX;
+  if (value < QDEG_MIN) return QDEG_MIN;
+  return (qdeg_t)value;
+}
+
+inline qdeg_t qdegFromDegrees(int16_t degrees) {
+  return qdegSaturate(((int32_t)degrees) * 4);
+}
+
+inline int16_t qdegToDegrees(qdeg_t temperature) {
+  return temperature >> 2;
+}
+
+inline qdeg_t qdegAdd(qdeg_t a, qdeg_t b) {
+  return qdegSaturate(((int32_t)a) + b);
+}
+
+inline qdeg_t qdegSub(qdeg_t a, qdeg_t b) {
+  return qdegSaturate(((int32_t)a) - b);
+}
+
+inline qdeg_t qdegAbs(qdeg_t a) {
+  return (a < 0) ? qdegSub(0, a) : a;
+}
+
+// Print in Degrees, to 2 decimal places.
+inline void printQdeg(qdeg_t temperature) {
+  int32_t t = temperature;
+
+  if (t < 0) {
+    Serial.print('-');
+    t = -t;
+  }
+  Serial.print(t >> 2);
+  Serial.print('.');
+  if ((t & 3) == 0) Serial.print('0');
+  Serial.print((uint8_t)((t & 3) * 25));
+}
+
+#endif
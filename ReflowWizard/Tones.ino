@@ -1,7 +1,7 @@
 // Play the selected tone
-// This is a synchronous (blocking) call.  The function doesn't return until the
-// tone has been played.  This works fine for this application, but it could be
-// done using a timer interrupt and a lot more (complicated) code.
+// playTones() starts the tune and returns.  Each note is started by serviceTones(),
+// called from the main loop, once the last has played, so a tune never holds up
+// the loop.
 
 #include "pitches.h"
 
@@ -21,18 +21,35 @@ void initTones(void) {
     pinMode(BUZZER_OUTPUT, OUTPUT);
 }
 
+// The tune being played, from its next note (NULL = none)
+const int *tonesToPlay = NULL;
+unsigned long noteStart;
+unsigned int noteLength;
+
 // Play a tone
 // Parameter: tone - an array containing alternating notes and note duration, terminated by -1
 void playTones(int tune) {
   if (tune >= MAX_TUNES)
     return;
-  const int *tonesToPlay = tones[tune];
-  for (int i=0; tonesToPlay[i] != -1; i+=2) {
-    // Note durations: 4 = quarter note, 8 = eighth note, etc.:   
-    int duration = 1000/tonesToPlay[i+1];
-    tone(BUZZER_OUTPUT, tonesToPlay[i], duration);
-    delay(duration * 1.1);
+  tonesToPlay = tones[tune];
+  noteLength = 0;
+  serviceTones();
+}
+
+// Start the next note, once the last one has played.
+void serviceTones(void) {
+  if ((tonesToPlay == NULL) || ((millis() - noteStart) < noteLength))
+    return;
+  if (tonesToPlay[0] == -1) {
+    noTone(BUZZER_OUTPUT);
+    tonesToPlay = NULL;
+    return;
   }
-  noTone(BUZZER_OUTPUT);
+  // Note durations: 4 = quarter note, 8 = eighth note, etc.:   
+  int duration = 1000/tonesToPlay[1];
+  tone(BUZZER_OUTPUT, tonesToPlay[0], duration);
+  noteStart = millis();
+  noteLength = duration + duration/10;
+  tonesToPlay += 2;
 }
 
@@ -0,0 +1,45 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Relay activity trace.
+// Records are kept in a RAM ring buffer, and sent over serial in binary when
+// there is room in the USB buffer, so tracing never blocks the relay timing.
+// When RELAY_TRACE is not defined, the trace macros are empty and no trace code is built.
+
+//#define RELAY_TRACE                     // Uncomment to trace relay activity
+
+#define TRACE_RECORDS    (32)             // Records buffered (Power of 2). Costs 6 bytes of RAM each.
+#define TRACE_AUTO_DRAIN (true)           // Send records as soon as possible. Otherwise wait for the 't' command.
+#define TRACE_SYNC       (0xA5)           // Sent before every record
+
+// Trace events
+#define TRACE_EV_RELAY_SET     (0x01)     // relay = Physical relay (0-3), duty = Requested duty, state = Applied duty
+#define TRACE_EV_RELAY_OUTPUTS (0x02)     // relay = 0xFF (All),  duty = PWM counter (0-99),  state = Outputs (RELAY_BIT_Dx)
+#define TRACE_EV_DROPPED       (0x03)     // relay = 0xFF (None), duty/state = Records lost (Lo/Hi byte)
+
+// A trace record, sent as TRACE_SYNC followed by these 6 bytes (little endian).
+typedef struct Trace_Record_t {
+  uint16_t time;                          // millis(), low 16 bits
+  uint8_t  event;                         // TRACE_EV_RELAY_SET, TRACE_EV_RELAY_OUTPUTS or TRACE_EV_DROPPED
+  uint8_t  relay;
+  uint8_t  duty;
+  uint8_t  state;
+} Trace_Record_t;
+
+#ifdef RELAY_TRACE
+void TraceRecord(uint8_t event, uint8_t relay, uint8_t duty, uint8_t state);
+void TraceCommand(char command);
+void TraceService(void);
+
+#define TRACE_RELAY_SET(relay, duty, power) TraceRecord(TRACE_EV_RELAY_SET, relay, duty, power)
+#define TRACE_RELAY_OUTPUTS(pwm, outputs)   TraceRecord(TRACE_EV_RELAY_OUTPUTS, 0xFF, pwm, outputs)
+#define TRACE_COMMAND(command)              TraceCommand(command)
+#define TRACE_SERVICE()                     TraceService()
+#else
+#define TRACE_RELAY_SET(relay, duty, power)
+#define TRACE_RELAY_OUTPUTS(pwm, outputs)
+#define TRACE_COMMAND(command)
+#define TRACE_SERVICE()
+#endif
+
+#endif
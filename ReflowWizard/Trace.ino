@@ -0,0 +1,65 @@
+// Relay activity trace, see Trace.h
+
+#include "Trace.h"
+
+#ifdef RELAY_TRACE
+
+static Trace_Record_t TraceBuffer[TRACE_RECORDS];
+static uint8_t  TraceHead     = 0;                // Next record to write
+static uint8_t  TraceTail     = 0;                // Next record to send
+static uint16_t TraceDropped  = 0;                // Records lost since the last TRACE_EV_DROPPED
+static bool     TraceDraining = TRACE_AUTO_DRAIN;
+
+// Add a record to the trace.  If the buffer is full the record is lost, and
+// counted, rather than waiting for the serial port.
+void TraceRecord(uint8_t event, uint8_t relay, uint8_t duty, uint8_t state) {
+  Trace_Record_t* record;
+  uint8_t room = (TraceTail - TraceHead - 1) & (TRACE_RECORDS - 1);
+
+  // Report lost records first, once there is room.
+  if ((TraceDropped != 0) && (room >= 2)) {
+    record = &TraceBuffer[TraceHead];
+    record->time  = millis();
+    record->event = TRACE_EV_DROPPED;
+    record->relay = 0xFF;
+    record->duty  = TraceDropped & 0xFF;
+    record->state = TraceDropped >> 8;
+    TraceHead = (TraceHead + 1) & (TRACE_RECORDS - 1);
+    TraceDropped = 0;
+    room--;
+  }
+
+  if ((TraceDropped != 0) || (room == 0)) {
+    if (TraceDropped < 0xFFFF) TraceDropped++;
+    return;
+  }
+
+  record = &TraceBuffer[TraceHead];
+  record->time  = millis();
+  record->event = event;
+  record->relay = relay;
+  record->duty  = duty;
+  record->state = state;
+  TraceHead = (TraceHead + 1) & (TRACE_RECORDS - 1);
+}
+
+// Handle the trace commands: 't' starts sending records, 'x' stops.
+void TraceCommand(char command) {
+  switch (command) {
+    case 't' : TraceDraining = true;  break;
+    case 'x' : TraceDraining = false; break;
+  }
+}
+
+// Call from the main loop.
+// Sends only as many records as fit in the serial buffer without blocking.
+void TraceService(void) {
+  while ((TraceDraining) && (TraceTail != TraceHead) &&
+         (Serial.availableForWrite() >= (int)(sizeof(Trace_Record_t) + 1))) {
+    Serial.write(TRACE_SYNC);
+    Serial.write((const uint8_t*)&TraceBuffer[TraceTail], sizeof(Trace_Record_t));
+    TraceTail = (TraceTail + 1) & (TRACE_RECORDS - 1);
+  }
+}
+
+#endif
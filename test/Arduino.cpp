@@ -0,0 +1,33 @@
+// Host stand-in for the Arduino core.  See Arduino.h.
+
+#include "Arduino.h"
+
+volatile uint8_t PORTB, PORTC, PORTD, PORTE, PORTF;
+volatile uint8_t PINB, PINC, PIND, PINE, PINF;
+volatile uint8_t DDRB, DDRC, DDRD, DDRE, DDRF;
+volatile uint8_t SREG;
+volatile uint8_t TCCR4A, TCCR4B, TCCR4C, TCCR4D, TCCR4E, TIMSK4, TIFR4;
+volatile uint8_t OCR4A, OCR4C, TC4H, TCNT4;
+
+HostSerial Serial;
+
+unsigned long hostMicros;
+
+void cli(void) {}
+void sei(void) {}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+int  digitalRead(uint8_t pin) { return LOW; }
+uint8_t digitalPinToPort(uint8_t pin) { return 0; }
+uint8_t digitalPinToBitMask(uint8_t pin) { return 0; }
+volatile uint8_t* portOutputRegister(uint8_t port) { return &PORTB; }
+
+unsigned long micros(void) { return hostMicros; }
+unsigned long millis(void) { return hostMicros / 1000; }
+void delay(unsigned long ms) { hostMicros += ms * 1000; }
+void delayMicroseconds(unsigned int us) { hostMicros += us; }
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
@@ -0,0 +1,111 @@
+// Host stand-in for the Arduino core, so sketch files can be compiled and
+// checked on a PC.  Only what the tested files use is provided.
+// Time is simulated: a test sets hostMicros, and millis() follows it.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+#define HIGH          1
+#define LOW           0
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+
+#define A0            18
+#define A1            19
+#define A2            20
+#define A3            21
+#define A4            22
+#define A5            23
+
+// Program memory is ordinary memory on the host.
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(p)        (*(const uint8_t*)(p))
+#define pgm_read_word(p)        (*(const uint16_t*)(p))
+#define pgm_read_dword(p)       (*(const uint32_t*)(p))
+#define pgm_read_byte_near(p)   pgm_read_byte(p)
+#define pgm_read_word_near(p)   pgm_read_word(p)
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+#define strcpy_P                strcpy
+#define strncpy_P               strncpy
+typedef const char* PGM_P;
+class __FlashStringHelper;
+#define F(s)                    ((const __FlashStringHelper*)(s))
+
+// MergedFlashData.h places strings with AVR assembler, so stands in for it too.
+#define __MergedFlashData__
+#define PSTRM(s)                (s)
+#define FM(s)                   F(s)
+#define FLASH_STRING(name)      const PROGMEM char name[]
+
+// Port registers, timer registers and interrupts.
+#define _BV(b)                  (1 << (b))
+#define PINB4                   4
+#define PORTB4                  4
+#define PORTB5                  5
+#define PORTB6                  6
+#define PORTC6                  6
+#define PORTD0                  0
+#define PORTD4                  4
+#define PORTD7                  7
+#define PORTE6                  6
+extern volatile uint8_t PORTB, PORTC, PORTD, PORTE, PORTF;
+extern volatile uint8_t PINB, PINC, PIND, PINE, PINF;
+extern volatile uint8_t DDRB, DDRC, DDRD, DDRE, DDRF;
+extern volatile uint8_t SREG;
+extern volatile uint8_t TCCR4A, TCCR4B, TCCR4C, TCCR4D, TCCR4E, TIMSK4, TIFR4;
+extern volatile uint8_t OCR4A, OCR4C, TC4H, TCNT4;
+#define ISR(vector, ...)        extern "C" void vector(void)
+#define ATOMIC_BLOCK(type)      for (uint8_t _atomic = 1; _atomic; _atomic = 0)
+#define ATOMIC_RESTORESTATE     0
+void cli(void);
+void sei(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int  digitalRead(uint8_t pin);
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t* portOutputRegister(uint8_t port);
+
+extern unsigned long hostMicros;
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define abs(x)                  ((x) > 0 ? (x) : -(x))
+template<class A, class B> auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template<class A, class B> auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+
+// Serial output is discarded.
+struct HostSerial {
+  void begin(long) {}
+  template<class T> void print(T) {}
+  template<class T, class U> void print(T, U) {}
+  template<class T> void println(T) {}
+  template<class T, class U> void println(T, U) {}
+  void println(void) {}
+  int  available(void) { return 0; }
+  int  read(void) { return -1; }
+  int  availableForWrite(void) { return 64; }
+  void write(uint8_t) {}
+  void write(const uint8_t*, size_t) {}
+  operator bool() { return true; }
+};
+extern HostSerial Serial;
+
+#endif
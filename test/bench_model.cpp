@@ -0,0 +1,279 @@
+// Benchmark the learnt oven model (Model.ino) on simulated ovens.
+// Compares three ways of running a reflow:
+//   legacy    - Reflow.ino's duty cycle learning, which aborts runs while it
+//               adjusts the duty cycles, until a run completes.
+//   PID       - ReflowTrack.ino's PID trajectory tracking, with 100% feed forward,
+//               the first run of a Mode, which learns the model.
+//   PID+model - the next runs, with the feed forward the model predicts.
+// The oven has a transport delay, a first order element lag and a thermocouple
+// lag, and is run with the J-STD profile at three gains.  The tracking error
+// is the rms of setpoint - thermocouple over the ramp phases.
+// This is a benchmark, with no pass or fail.  Run with "make bench".
+
+#include <stdio.h>
+#include <vector>
+#include "Arduino.h"
+#include "PID.h"
+#include "Model.h"
+#include "Model.ino"
+
+#define SIM_STEP      (0.25)   // Seconds, the thermocouple sample time
+#define PHASES        (3)      // Presoak, Soak, Reflow
+#define LEGACY_RUNS   (12)     // Most runs the legacy learning is given
+#define MODEL_RUNS    (3)
+
+// The three elements heat the air through a transport delay and a lag, the air
+// loses heat to the room, and the thermocouple lags the air.
+typedef struct Oven_t {
+  double gain[MODEL_ELEMENTS];  // Degrees per second at 100%
+  double tau;                   // Element lag (seconds)
+  double loss;                  // Fraction of (T - ambient) lost a second
+  double delay;                 // Transport delay (seconds)
+  double tau_tc;                // Thermocouple lag (seconds)
+  double ambient;
+
+  double heat, air, tc;
+  std::vector<double> queue[MODEL_ELEMENTS];
+  size_t next;
+
+  void reset(void) {
+    heat = 0;
+    air = tc = ambient;
+    for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) queue[i].assign((size_t)(delay / SIM_STEP) + 1, 0);
+    next = 0;
+  }
+
+  void step(const double duty[MODEL_ELEMENTS]) {
+    double in = 0;
+    size_t n = queue[0].size();
+
+    for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) {
+      queue[i][next] = duty[i];
+      in += gain[i] * queue[i][(next + 1) % n] / 100;
+    }
+    next = (next + 1) % n;
+    heat += SIM_STEP * (in - heat) / tau;
+    air  += SIM_STEP * (heat - loss * (air - ambient));
+    tc   += SIM_STEP * (air - tc) / tau_tc;
+  }
+
+  int16_t sample(void) { return (int16_t)lround(tc * 4); }
+} Oven_t;
+
+// A ramp phase of the profile.
+typedef struct Phase_t {
+  double maxtemp, mintime, maxtime;
+  double duty[MODEL_ELEMENTS];
+} Phase_t;
+
+static const Phase_t jstd[PHASES] = {
+  { 150, 60, 110, { 80, 30, 50 } },
+  { 200, 80, 140, { 70, 35, 40 } },
+  { 240, 60, 100, { 80, 50, 50 } },
+};
+
+// Rate over the last second, as TC_Sample_t (0.01 Degree per second).
+typedef struct Rate_t {
+  double history[5];
+  void reset(double t) { for (uint8_t i = 0; i < 5; i++) history[i] = t; }
+  int16_t add(double t) {
+    memmove(history, history + 1, 4 * sizeof(double));
+    history[4] = t;
+    return (int16_t)lround((history[4] - history[0]) * 100);
+  }
+} Rate_t;
+
+typedef struct Result_t {
+  bool   ok;
+  double time[PHASES];  // Seconds each phase took
+  double rms;           // Tracking error (Degrees)
+  double peak;          // Highest temperature seen (Degrees)
+} Result_t;
+
+static double clamp(double x, double low, double high) { return x < low ? low : (x > high ? high : x); }
+
+// Reflow.ino: fixed duty cycles per phase, learnt by aborting runs that miss the phase times.
+static Result_t legacy(Oven_t& oven, Phase_t profile[PHASES]) {
+  Result_t result = {};
+  double   t = 0, start = 0;
+  double   duty[MODEL_ELEMENTS];
+  uint8_t  phase = 0;
+
+  oven.reset();
+  while ((t < 1000) && (phase < PHASES)) {
+    Phase_t& p = profile[phase];
+
+    if (oven.tc >= p.maxtemp) {
+      result.time[phase] = t - start;
+      if (result.time[phase] < p.mintime) {
+        // Too fast.  A little under the time is learnt, and the run goes on.
+        bool abort = (p.mintime - result.time[phase]) >= 8;
+        for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) p.duty[i] -= abort ? 8 : 5;
+        if (abort) break;
+      }
+      phase++;
+      start = t;
+      continue;
+    }
+    if ((t - start) > p.maxtime) {
+      // Too slow.  Close to the temperature is learnt, and the run goes on.
+      double short_by = p.maxtemp - oven.tc;
+      result.time[phase] = t - start;
+      if (short_by > 5) {
+        for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) p.duty[i] += (short_by < 10) ? 9 : 18;
+        break;
+      }
+      for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) p.duty[i] += 4;
+      p.maxtime += 20;
+    }
+
+    for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) duty[i] = p.duty[i];
+    if ((phase == 0) && (oven.tc < (p.maxtemp * 3 / 5) - 10)) duty[0] = duty[1] = duty[2] = 100;
+    oven.step(duty);
+    t += SIM_STEP;
+    if (oven.tc < 50) start = t;
+    result.peak = max(result.peak, oven.tc);
+  }
+
+  result.ok = (phase == PHASES);
+  if (result.ok) {
+    // Waiting, elements off
+    double off[MODEL_ELEMENTS] = {};
+    for (uint16_t k = 0; k < 160; k++) {
+      oven.step(off);
+      result.peak = max(result.peak, oven.tc);
+    }
+  }
+  for (uint8_t j = 0; j < PHASES; j++) {
+    profile[j].duty[0] = clamp(profile[j].duty[0], 0, 100);
+    profile[j].duty[1] = clamp(profile[j].duty[1], 0, 60);
+    profile[j].duty[2] = clamp(profile[j].duty[2], 0, 80);
+  }
+  return result;
+}
+
+// ReflowTrack.ino: PID tracking of the trajectory, learning the model.
+static Result_t track(Oven_t& oven, Oven_Model_t& learnt, bool& have_model, bool use_model) {
+  static ControLeo2_OvenModel model;
+  ControLeo2_PID pid;
+  Result_t result = {};
+  Rate_t   rate_of;
+  uint8_t  duty[MODEL_ELEMENTS] = {};
+  uint8_t  phase_duty[MODEL_ELEMENTS];
+  uint8_t  phase = 0;
+  uint8_t  feedforward = 100;
+  int16_t  start_temp, setpoint, slope;
+  uint32_t track_time = 0;
+  double   t = 0, start = 0, error = 0;
+  long     samples = 0;
+  int      last_second = -1;
+
+  oven.reset();
+  rate_of.reset(oven.tc);
+  start_temp = oven.sample();
+  pid.setGains(PID_OVEN_KP, PID_OVEN_KI, PID_OVEN_KD);
+
+  model.begin((use_model && have_model) ? &learnt : NULL, oven.sample());
+  model.learn(true);
+
+  auto duration = [](uint8_t phase) { return (uint32_t)((jstd[phase].mintime + jstd[phase].maxtime) * 500); };
+  auto target = [&](uint8_t phase, uint32_t time) {
+    int16_t end = (int16_t)(jstd[phase].maxtemp * 4);
+    if (time >= duration(phase)) return end;
+    return (int16_t)(start_temp + ((int32_t)(end - start_temp) * (int32_t)time) / (int32_t)duration(phase));
+  };
+  auto start_phase = [&](uint8_t phase) {
+    double largest = max(max(jstd[phase].duty[0], jstd[phase].duty[1]), jstd[phase].duty[2]);
+    pid.setLimits(0, min(10000 / (int)largest, PID_MAX_POWER));
+    for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) phase_duty[i] = (uint8_t)jstd[phase].duty[i];
+  };
+  start_phase(0);
+
+  for (;;) {
+    int16_t temperature = oven.sample();
+    int16_t rate = rate_of.add(oven.tc);
+
+    if (phase < PHASES) {
+      setpoint = target(phase, track_time);
+      slope = (track_time < duration(phase)) ?
+              (int16_t)((((int32_t)((int16_t)(jstd[phase].maxtemp * 4) - start_temp)) * 25000L) / (int32_t)duration(phase)) : 0;
+      if ((setpoint - temperature) < PID_HOLD_ERROR) track_time += (uint32_t)(SIM_STEP * 1000);
+
+      int16_t power = pid.update(setpoint, temperature, rate - slope, feedforward, (uint16_t)(SIM_STEP * 1000));
+      for (uint8_t i = 0; i < MODEL_ELEMENTS; i++) duty[i] = min((phase_duty[i] * power) / 100, 100);
+      error += ((setpoint - temperature) / 4.0) * ((setpoint - temperature) / 4.0);
+      samples++;
+
+      if ((track_time >= duration(phase)) && ((phase != PHASES - 1) || ((setpoint - temperature) <= PID_AT_ERROR))) {
+        result.time[phase] = t - start;
+        start_temp = setpoint;
+        track_time = 0;
+        start = t;
+        if (++phase < PHASES) start_phase(phase);
+        else memset(duty, 0, sizeof(duty));
+      } else if ((t - start) > jstd[phase].maxtime) {
+        result.time[phase] = t - start;
+        break;
+      }
+    } else if ((t - start) >= 40) {
+      // End of waiting, fit the model.
+      model.learn(false);
+      if (model.fit(learnt)) have_model = true;
+      result.ok = true;
+      break;
+    }
+
+    if ((int)t != last_second) {
+      last_second = (int)t;
+      model.second(temperature, rate, duty);
+      feedforward = 100;
+      if ((phase < PHASES) && model.valid()) {
+        uint32_t remaining = (duration(phase) > track_time) ? (duration(phase) - track_time) / 1000 : 0;
+        uint8_t  horizon = min(max(remaining, model.model().dead_time + 1UL), (uint32_t)MODEL_HORIZON);
+        feedforward = model.predictPower(temperature, target(phase, track_time + horizon * 1000UL), horizon,
+                                         phase_duty, PID_MAX_POWER);
+      }
+    }
+
+    double applied[MODEL_ELEMENTS] = { (double)duty[0], (double)duty[1], (double)duty[2] };
+    oven.step(applied);
+    t += SIM_STEP;
+    result.peak = max(result.peak, oven.tc);
+  }
+  result.rms = sqrt(error / max(samples, 1L));
+  return result;
+}
+
+int main(void) {
+  static const double gains[] = { 1.0, 1.2, 1.4 };
+
+  for (uint8_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+    Oven_t   base = { { 1.2 * gains[g], 0.6 * gains[g], 0.9 * gains[g] }, 25, 1 / 250.0, 6, 3, 25 };
+    Phase_t  profile[PHASES];
+    Result_t r;
+    uint8_t  runs = 0;
+
+    printf("model: oven gain x%.2f\n", gains[g]);
+
+    memcpy(profile, jstd, sizeof(profile));
+    do {
+      Oven_t oven = base;
+      r = legacy(oven, profile);
+      runs++;
+      printf("model:   legacy    run %2u: %s  phases %3.0f/%3.0f/%3.0fs  peak %5.1fC\n", runs,
+             r.ok ? "done " : "abort", r.time[0], r.time[1], r.time[2], r.peak);
+    } while (!r.ok && (runs < LEGACY_RUNS));
+
+    Oven_Model_t learnt = {};
+    bool have_model = false;
+    for (uint8_t run = 1; run <= MODEL_RUNS; run++) {
+      Oven_t oven = base;
+      r = track(oven, learnt, have_model, run > 1);
+      printf("model:   %s run %2u: %s  phases %3.0f/%3.0f/%3.0fs  peak %5.1fC  rms %4.2fC"
+             "  learnt gain %u/%u/%u loss %u tau %u dead time %u\n",
+             (run > 1) ? "PID+model" : "PID      ", run, r.ok ? "done " : "abort", r.time[0], r.time[1], r.time[2],
+             r.peak, r.rms, learnt.gain[0], learnt.gain[1], learnt.gain[2], learnt.loss, learnt.tau, learnt.dead_time);
+    }
+  }
+  return 0;
+}
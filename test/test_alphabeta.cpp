@@ -0,0 +1,102 @@
+// Check the ControLeo2_AlphaBeta lag estimator on a simulated reflow.
+// The true oven temperature follows a reflow profile.  The thermocouple sees
+// it through a first order lag, with gaussian noise, quantised to Quarter
+// Degrees and sampled every 250ms, as the MAX31855 is.  The error of the raw
+// reading, the boxcar average and the compensated temperature against the true
+// temperature is measured after the first 20s.
+// With the right time constant, the compensated rms error must be under a
+// quarter of the raw error.  With it set 50% low or high, it must still be
+// well under the raw error.
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "ControLeo2.h"
+
+#define SIM_STEP      (0.001)  // Seconds
+#define SIM_END       (400.0)  // Seconds
+#define SAMPLE_MS     (250)
+#define SETTLE        (20.0)   // Seconds before errors are counted
+
+// Reflow profile, Degrees at time t seconds.
+static double profile(double t) {
+  if (t < 80)  return 25 + 1.5 * t;             // Ramp to 145C
+  if (t < 170) return 145 + (t - 80) * 0.5;     // Soak to 190C
+  if (t < 210) return 190 + (t - 170) * 1.25;   // Ramp to 240C
+  if (t < 230) return 240;                      // Peak
+  return max(50.0, 240 - (t - 230) * 3.0);      // Cool
+}
+
+// Repeatable gaussian noise (Box-Muller on a fixed LCG).
+static uint32_t seed;
+static double gaussian(double sigma) {
+  seed = seed * 1664525UL + 1013904223UL;
+  double u1 = ((seed >> 8) + 1.0) / 16777217.0;
+  seed = seed * 1664525UL + 1013904223UL;
+  double u2 = (seed >> 8) / 16777216.0;
+  return sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+typedef struct Errors_t {
+  double rms[3];   // Raw, boxcar, compensated
+  double worst[3];
+} Errors_t;
+
+static Errors_t simulate(double tau, double noise, double tau_set) {
+  ControLeo2_AlphaBeta<THERMOCOUPLE_ALPHA_SHIFT, THERMOCOUPLE_BETA_SHIFT> lag;
+  ControLeo2_Filter<THERMOCOUPLE_FILTER_SHIFT> boxcar;
+  Errors_t result = {};
+  double   sensor = profile(0);
+  double   sum[3] = {};
+  long     count = 0;
+  uint32_t ms = 0;
+
+  seed = 1;
+  lag.setLag((uint16_t)(tau_set * 1000));
+  for (long i = 0; i * SIM_STEP < SIM_END; i++) {
+    double t = i * SIM_STEP;
+    double actual = profile(t);
+    sensor += (actual - sensor) * SIM_STEP / tau;
+
+    if ((i % SAMPLE_MS) != 0) continue;
+
+    int16_t sample = (int16_t)lround((sensor + gaussian(noise)) * 4);
+    if (ms == 0) boxcar.reset(sample);
+    else         boxcar.add(sample);
+    lag.add(ms, sample);
+    ms += SAMPLE_MS;
+
+    if (t < SETTLE) continue;
+    double error[3] = { sensor - actual, boxcar.read(0) / 4.0 - actual, lag.compensated() / 4.0 - actual };
+    for (uint8_t j = 0; j < 3; j++) {
+      sum[j] += error[j] * error[j];
+      result.worst[j] = max(result.worst[j], fabs(error[j]));
+    }
+    count++;
+  }
+  for (uint8_t j = 0; j < 3; j++) {
+    result.rms[j] = sqrt(sum[j] / count);
+  }
+  return result;
+}
+
+int main(void) {
+  static const double cases[][4] = {
+    // tau, noise, tau set, largest compensated / raw rms error
+    { 2, 0.25, 2, 0.25 }, { 4, 0.25, 4, 0.25 }, { 4, 0.50, 4, 0.25 }, { 8, 0.25, 8, 0.25 },
+    { 4, 0.25, 2, 0.6 },  { 4, 0.25, 6, 0.6 },
+  };
+  bool pass = true;
+
+  printf("alphabeta: tau  noise  set | raw rms   max | boxcar rms   max | compensated rms   max\n");
+  for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Errors_t e = simulate(cases[i][0], cases[i][1], cases[i][2]);
+    printf("alphabeta: %2.0fs  %.2fC  %2.0fs | %6.2fC %5.1fC |   %6.2fC %5.1fC |        %6.2fC %5.1fC\n",
+           cases[i][0], cases[i][1], cases[i][2], e.rms[0], e.worst[0], e.rms[1], e.worst[1], e.rms[2], e.worst[2]);
+    if (e.rms[2] >= e.rms[0] * cases[i][3]) pass = false;
+  }
+  if (!pass) {
+    printf("alphabeta: FAIL, compensated error is too large\n");
+    return 1;
+  }
+  return 0;
+}
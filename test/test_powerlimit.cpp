@@ -0,0 +1,111 @@
+// Check the circuit power limit of the relay scheduler (Relays.ino).
+// Relays.ino is stepped through whole PWM cycles, for several mixes of relay
+// loads (SG_Dx_WATTS) and circuit limits (SG_CIRCUIT_WATTS), and the relay
+// outputs are read back from the ports every step.
+// No step may draw more than the limit.  When the relays can be fitted in the
+// limit, each relay must get exactly its duty; when they can't, no relay may
+// get more than its duty.
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "ControLeo2.h"
+
+uint16_t settings[SG_CHECK_VALUE];
+uint16_t readGlobalSetting(SG_Entries_t entry) { return settings[entry]; }
+
+#include "Relays.ino"
+
+#define CYCLES        (3)      // PWM cycles checked, after the first
+
+// Each physical relay is driven by its own virtual relay, so each has its own duty.
+static const ControLeo2_Relays::RELAY types[PHYSICAL_RELAYS] = {
+  ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, ControLeo2_Relays::RELAY_BOOST_ELEMENT,
+  ControLeo2_Relays::RELAY_TOP_ELEMENT, ControLeo2_Relays::RELAY_CONVECTION_FAN
+};
+
+typedef struct Case_t {
+  const char* name;
+  uint16_t    watts[PHYSICAL_RELAYS];  // SG_D4_WATTS to SG_D7_WATTS
+  uint16_t    circuit;                 // SG_CIRCUIT_WATTS
+  uint8_t     duty[PHYSICAL_RELAYS];
+  bool        fits;                    // The duties can be met in the limit
+} Case_t;
+
+static const Case_t cases[] = {
+  { "no limit",            { 1500, 1000, 1500,   0 },    0, { 60, 40, 50, 30 }, true  },
+  { "one element at once", { 1500, 1000, 1500,   0 }, 2400, { 40, 30, 25, 50 }, true  },
+  { "two elements at once",{ 1500, 1000, 1500,   0 }, 3000, { 80, 60, 50, 30 }, true  },
+  { "budgeted fan",        { 1500, 1500,    0, 100 }, 1600, { 50, 40, 70, 100 }, true },
+  { "unequal loads",       { 1800,  600,  600,   0 }, 2400, { 50, 90, 40, 20 }, true  },
+  { "load over the limit", { 1500, 1000, 2000,   0 }, 1600, { 30, 40, 20, 60 }, false },
+  { "too much duty",       { 1500, 1000, 1500,   0 }, 2400, { 60, 50, 40, 50 }, false },
+};
+
+// Outputs written to the relay pins, as RELAY_BIT_Dx.
+static uint8_t readOutputs(void) {
+  return (PORTD & (RELAY_BIT_D4 | RELAY_BIT_D6)) | ((PORTC >> PORTC6) & RELAY_BIT_D5) | (PORTE & RELAY_BIT_D7);
+}
+
+static bool check(const Case_t& c) {
+  ControLeo2_Relays relays;
+  uint16_t on[PHYSICAL_RELAYS] = {};
+  uint16_t peak = 0;
+  bool     pass = true;
+
+  hostMicros = 0;
+  PORTC = PORTD = PORTE = 0;
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    settings[SG_D4_TYPE + i]   = types[i];
+    settings[SG_D4_MAXPWR + i] = 100;
+    settings[SG_D4_WATTS + i]  = c.watts[i];
+  }
+  settings[SG_CIRCUIT_WATTS] = c.circuit;
+  relays.ReadSettings();
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) relays.SetRelay(types[i], c.duty[i]);
+
+  for (uint16_t step = 0; step < (CYCLES + 1) * PWM_STEPS; step++) {
+    hostMicros += PWM_MIN_FREQ_US;
+    relays.ProcessRelays();
+    if (step < PWM_STEPS) continue;   // The pattern settles in the first cycle
+
+    uint8_t  outputs = readOutputs();
+    uint16_t load = 0;
+    for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+      if (outputs & pgm_read_byte(&RelayBit[i])) {
+        on[i]++;
+        load += c.watts[i];
+      }
+    }
+    peak = max(peak, load);
+    if ((c.circuit != 0) && (load > c.circuit)) {
+      printf("powerlimit: FAIL, %s step %u draws %uW, over %uW\n", c.name, step, load, c.circuit);
+      pass = false;
+    }
+  }
+
+  printf("powerlimit: %-21s peak %4uW of %4uW, on", c.name, peak, c.circuit);
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) printf(" %3u/%3u", on[i] / CYCLES, c.duty[i]);
+  printf("\n");
+
+  for (uint8_t i = 0; i < PHYSICAL_RELAYS; i++) {
+    if ((c.fits && (on[i] != c.duty[i] * CYCLES)) || (on[i] > c.duty[i] * CYCLES)) {
+      printf("powerlimit: FAIL, %s relay D%u on %u steps, duty %u%% is %u\n", c.name, 4 + i, on[i],
+             c.duty[i], c.duty[i] * CYCLES);
+      pass = false;
+    }
+    if ((c.circuit != 0) && (c.watts[i] > c.circuit) && (on[i] != 0)) {
+      printf("powerlimit: FAIL, %s relay D%u is over the limit alone, but was turned on\n", c.name, 4 + i);
+      pass = false;
+    }
+  }
+  return pass;
+}
+
+int main(void) {
+  bool pass = true;
+
+  for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    if (!check(cases[i])) pass = false;
+  }
+  return pass ? 0 : 1;
+}
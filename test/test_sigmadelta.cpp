@@ -0,0 +1,110 @@
+// Compare Sigma-Delta and PWM relay modulation, driving a simulated oven.
+// Relays.ino is stepped in simulated time, with relay D4 as the only element.
+// The oven is a 1500W element heating a 200J/K air node, coupled at 10W/K to
+// an 8000J/K load, with 6W/K lost to the room.  After settling, the air
+// temperature ripple (about the slowly moving load) and the relay switches
+// are measured for each duty.
+// Both modulations must give exactly the duty asked for, and Sigma-Delta must
+// have less ripple than PWM at every duty.
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "ControLeo2.h"
+
+uint16_t settings[SG_CHECK_VALUE];
+uint16_t readGlobalSetting(SG_Entries_t entry) { return settings[entry]; }
+
+#include "Relays.ino"
+
+#define SIM_STEP_US   (1000)
+#define SIM_SECONDS   (1200)
+#define SETTLE        (900)    // Seconds before ripple is measured
+
+#define ELEMENT_W     (1500.0)
+#define AIR_J_K       (200.0)
+#define LOAD_J_K      (8000.0)
+#define AIR_LOAD_W_K  (10.0)
+#define LOSS_W_K      (6.0)
+#define AMBIENT       (25.0)
+
+typedef struct Result_t {
+  double   ripple;     // Peak-peak air temperature about the load (Degrees)
+  double   switches;   // Relay switches per minute
+  uint32_t on_steps;   // PWM steps on
+  uint32_t steps;      // PWM steps
+} Result_t;
+
+static Result_t simulate(ControLeo2_Relays::MODULATION mode, uint8_t duty) {
+  ControLeo2_Relays relays;
+  Relay_Counters_t  counters;
+  Result_t result = {};
+  double   power = ELEMENT_W * duty / 100;
+  double   load  = AMBIENT + power / LOSS_W_K; // Start settled
+  double   air   = load;
+  double   low   = 1e9;
+  double   high  = -1e9;
+  uint32_t first_steps = 0, first_on = 0, first_switches = 0;
+
+  hostMicros = 0;
+  PORTD = 0;
+  relays.ReadSettings();
+  relays.SetModulation(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, mode);
+  relays.SetRelay(ControLeo2_Relays::RELAY_BOTTOM_ELEMENT, duty);
+
+  for (long i = 0; i < (SIM_SECONDS * 1000000L) / SIM_STEP_US; i++) {
+    hostMicros = i * SIM_STEP_US;
+    relays.ProcessRelays();
+
+    double heat = (PORTD & RELAY_BIT_D4) ? ELEMENT_W : 0;
+    double flow = AIR_LOAD_W_K * (air - load);
+    air  += (heat - flow - LOSS_W_K * (air - AMBIENT)) * SIM_STEP_US / 1e6 / AIR_J_K;
+    load += flow * SIM_STEP_US / 1e6 / LOAD_J_K;
+
+    if (hostMicros == SETTLE * 1000000UL) {
+      relays.GetCounters(counters);
+      first_steps    = hostMicros / PWM_MIN_FREQ_US;
+      first_on       = counters.on_steps[0];
+      first_switches = counters.switches[0];
+    } else if (hostMicros > SETTLE * 1000000UL) {
+      low  = min(low, air - load);
+      high = max(high, air - load);
+    }
+  }
+
+  relays.GetCounters(counters);
+  result.ripple   = high - low;
+  result.switches = (counters.switches[0] - first_switches) * 60.0 / (SIM_SECONDS - SETTLE);
+  result.on_steps = counters.on_steps[0] - first_on;
+  result.steps    = (hostMicros / PWM_MIN_FREQ_US) - first_steps;
+  return result;
+}
+
+int main(void) {
+  static const uint8_t duties[] = { 5, 10, 20, 30, 50, 75 };
+  bool pass = true;
+
+  settings[SG_D4_TYPE]   = ControLeo2_Relays::RELAY_BOTTOM_ELEMENT;
+  settings[SG_D4_MAXPWR] = 100;
+
+  printf("sigmadelta: duty | PWM ripple  switches | Sigma-Delta ripple  switches\n");
+  for (uint8_t i = 0; i < sizeof(duties); i++) {
+    Result_t pwm = simulate(ControLeo2_Relays::MODULATION_PWM, duties[i]);
+    Result_t sd  = simulate(ControLeo2_Relays::MODULATION_SIGMA_DELTA, duties[i]);
+
+    printf("sigmadelta:  %2u%% |    %5.2fC  %4.0f/min |            %5.2fC  %4.0f/min\n",
+           duties[i], pwm.ripple, pwm.switches, sd.ripple, sd.switches);
+
+    // Whole PWM cycles, so the on time is exact, give or take the cycle in progress.
+    if ((labs((long)(pwm.on_steps * 100) - (long)(pwm.steps * duties[i])) > 100 * duties[i]) ||
+        (labs((long)(sd.on_steps * 100)  - (long)(sd.steps * duties[i]))  > 100 * duties[i])) {
+      printf("sigmadelta: FAIL, %u%% duty gave PWM %u/%u, Sigma-Delta %u/%u steps on\n", duties[i],
+             pwm.on_steps, pwm.steps, sd.on_steps, sd.steps);
+      pass = false;
+    }
+    if (sd.ripple >= pwm.ripple) {
+      printf("sigmadelta: FAIL, Sigma-Delta ripple is not less than PWM\n");
+      pass = false;
+    }
+  }
+  return pass ? 0 : 1;
+}
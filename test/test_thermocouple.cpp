@@ -0,0 +1,77 @@
+// Check LinearizeThermocouple() against the double precision calculation it
+// replaced, for every Quarter Degree reading and cold junction temperature
+// that gives 0C to 500C (inclusive).  The error must stay under 0.25C.
+
+#include <stdio.h>
+#include "Arduino.h"
+
+int16_t LinearizeThermocouple(int16_t temp, int16_t juncTemp);
+#include "ControLeo2_MAX31855.ino"
+
+#define JUNCTION_MAX   (70)     // Degrees, hottest cold junction checked
+#define LIMIT          (0.25)   // Degrees
+
+// The original implementation, returning the unrounded temperature.  Only the
+// 0C to 500C range check is left to the caller, so the ends can be compared.
+static double referenceLinearize(int16_t temp, int16_t juncTemp, double* totalVoltage) {
+  double internalTemp = juncTemp / 4.0;
+  double rawTemp = temp / 4.0;
+  double thermocoupleVoltage = (rawTemp - internalTemp) * 0.041276;
+  double internalVoltage = 0;
+  double correctedTemp = 0;
+  uint8_t i;
+
+  static const double c[] = {-0.176004136860E-01,  0.389212049750E-01,  0.185587700320E-04,
+                             -0.994575928740E-07,  0.318409457190E-09, -0.560728448890E-12,
+                              0.560750590590E-15, -0.320207200030E-18,  0.971511471520E-22,
+                             -0.121047212750E-25};
+  const double a0 =  0.118597600000E+00;
+  const double a1 = -0.118343200000E-03;
+  const double a2 =  0.126968600000E+03;
+  static const double d[] = { 0.000000E+00,  2.508355E+01,  7.860106E-02,
+                             -2.503131E-01,  8.315270E-02, -1.228034E-02,
+                              9.804036E-04, -4.413030E-05,  1.057734E-06,
+                             -1.052755E-08};
+
+  for (i = 0; i < sizeof(c) / sizeof(c[0]); i++) {
+    internalVoltage += c[i] * pow(internalTemp, i);
+  }
+  internalVoltage += a0 * exp(a1 * pow((internalTemp - a2), 2));
+
+  *totalVoltage = thermocoupleVoltage + internalVoltage;
+  for (i = 0; i < sizeof(d) / sizeof(d[0]); i++) {
+    correctedTemp += d[i] * pow(*totalVoltage, i);
+  }
+  return correctedTemp;
+}
+
+int main(void) {
+  double  worst = 0;
+  int16_t worstTemp = 0, worstJunction = 0;
+  long    checked = 0;
+
+  for (int16_t junction = 0; junction <= JUNCTION_MAX * 4; junction++) {
+    for (int16_t temp = -20 * 4; temp <= 520 * 4; temp++) {
+      double voltage;
+      double expected = referenceLinearize(temp, junction, &voltage);
+
+      if ((voltage < 0) || (expected > 500.0)) continue;
+
+      double error = fabs(LinearizeThermocouple(temp, junction) / 4.0 - expected);
+      if (error > worst) {
+        worst = error;
+        worstTemp = temp;
+        worstJunction = junction;
+      }
+      checked++;
+    }
+  }
+
+  printf("thermocouple: %ld readings, max error %.3fC (reading %.2fC, junction %.2fC)\n",
+         checked, worst, worstTemp / 4.0, worstJunction / 4.0);
+  if (worst >= LIMIT) {
+    printf("thermocouple: FAIL, error is not under %.2fC\n", LIMIT);
+    return 1;
+  }
+  return 0;
+}